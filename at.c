@@ -14,33 +14,34 @@
 #include "song.h"
 #include "piano.h"
 #include "ga.h"
+#include "transform.h"
+#include "island.h"
+#include "rng.h"
+#include "seed.h"
+#include "prof.h"
+#include "daemon.h"
+#include "segment.h"
+#include "tiles.h"
 
-#define PI 3.14159265358979
-#define baseF 27.5		// Lowest frequency on piano
-#define W_KEYS 112		// Upper range of wavelet transform (pitches above A0)
-
-// Information for the wavelet transform
-typedef struct process_info
-{
-	int height; // Output transform height
-	int width;	// Output transform width
-	double st;	// Start time of transform relative to start of audio sample
-	double et;	// End time of transform relative to start of audio sample
-	double b1;	// Beta value of transform
-	double b2;	// Second beta value -- currently unsupported
-	int sqrtt;	// Square root option with multiple beta values -- currently unsupported
-	int phase;	// Whether to calculate phase
-	int us;		// Whether to speed up calculation time by undersampling
-} process_info;
-
-
-int check_inputs(int argc, char* argv[], process_info* pi);
+int check_inputs(int argc, char* argv[], process_info* pi, ga_info* gi);
 void print_arr(double arr[], int s);
-double conv(double arr[], int s, int* sig, int datalen, int i);
-int wavelet_trans(wav_info* header, int datalen, process_info* pi,
-		int* signal, double* tform, double* tphase);
-void normalize_transform(double* tform, int t_size, double max);
-void writeToImage(char* filename, process_info* pi, double* tform, double* tphase);
+void transcribe(wav_info* header, int datalen, process_info* pi, ga_info* gi,
+		int* signal, double* goal, double goal_max, char* outname);
+void change_ext(char* dst, char* src, char* ext);
+int run_client(process_info* pi, ga_info* gi, char* in, char* out,
+		unsigned long long seed);
+void transcribe_segmented(process_info* pi, ga_info* gi, int* signal, int datalen,
+		unsigned long long seed, char* outname);
+double transform_channels(FILE* fp, wav_info* header, int datalen, process_info* pi,
+		int** signal, double* tform, double* tphase, char* outname);
+
+static int stats = 0;		// Print stage timings and work counters (--stats)
+static char* trace = NULL;	// Chrome trace file (--trace)
+static char* server = NULL;	// Socket of a daemon to send the job to (--connect)
+static double seg_len = 0;	// Length of segments transcribed in parallel (0: one song)
+static double seg_ovl = 1;	// Overlap between segments in seconds
+static char* tile_dir = NULL;	// Directory of a tiled zoom pyramid to write instead of the image
+static int chan_mode = 0;	// Channel images to write: 0 none, 1 each channel, 2 mid and side (-ch)
 
 
 int main(int argc, char* argv[])
@@ -48,24 +49,59 @@ int main(int argc, char* argv[])
 	puts("Auto-transcribe v0.1");
 	
 	int datalen, t_size;
+	double max;
 	FILE* fp;
 	wav_info header;
 	double *transform, *transphase;
 	int* signal;
+	int workers;
+	unsigned long long seed = time(NULL);
 
 	// Set defaults for the wavelet transform settings
 	process_info p_i = { .sqrtt = 0, .b1 = 16, .b2 = 1, .st = 0,
-	.et = 15, .width = 1000, .height = W_KEYS, .phase = 0, .us = 0 };
+	.et = 15, .width = 1000, .height = W_KEYS, .phase = 0, .us = 0, .norm = 0 };
+	// Set defaults for the genetic algorithm: no transcription unless -g is given
+	ga_info g_i = { .sel_type = SEL_ROULETTE, .tour_size = 2, .ev = NULL,
+	.gens = 0, .pop_size = 100, .est_notes = 20, .islands = 1, .mig_int = 10,
+	.ckpt = NULL, .ckpt_int = 10, .resume = NULL, .out = NULL, .ls_int = 0,
+	.ls_top = 1, .seed = 1, .seeds = NULL, .nseeds = 0,
+	.mf_levels = 0, .mf_keep = 0.5, .elite = 0, .offspring = 1, .verbose = 1,
+	.quant = 0, .bpm = 0, .sub = GRID_SUB, .jitter = 0, .grid = NULL };
+	// Set defaults for writing songs during evolution: off unless -o is given
+	out_info o_i = { .dir = NULL, .every = 1, .top_k = 1,
+	.kinds = OUT_TXT|OUT_WAV|OUT_BMP };
 	
-	srand(time(NULL)); // Seed RNG
+	rng_seed(seed); // Seed RNG
+	
+	// Serve jobs sent by clients (--connect) until interrupted
+	if (argc >= 3 && strcmp(argv[1],"--serve")==0)
+	{
+		workers = (argc >= 4) ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+		return (run_daemon(argv[2], workers, "notes") < 0) ? 1 : 0;
+	}
 	
 	// Check inputs and return usage message if necessary
-	if (check_inputs(argc, argv, &p_i) < 0)
+	g_i.out = &o_i;
+	if (check_inputs(argc, argv, &p_i, &g_i) < 0)
 	{
 		printf("Usage: at [-w width] [-h height] [-st start time] "
-		"[-et end time] [-b b1] [-b2 b2] [-s] [-p] [-us]\n <in.wav> <out.bmp>");
+		"[-et end time] [-b b1] [-b2 b2] [-s] [-p] [-us] [-ust tolerance]\n"
+		" [-g generations] [-n population] [-notes estimated notes]"
+		" [-sel roulette|tournament|rank]\n [-i islands] [-m migration interval]"
+		" [-cp checkpoint file] [-cpi checkpoint interval] [-r resume file]\n"
+		" [-o output directory] [-oe output interval] [-ok songs per output]"
+		" [-of t|w|b]\n [-ls refinement interval] [-lsk songs to refine] [-rand]"
+		" [-mf screening levels] [-mfk fraction promoted]\n [-e elites]"
+		" [-off fraction replaced]\n [-q] [-bpm tempo] [-sub lines per beat]"
+		" [-qj start jitter]\n [-seg segment length] [-ovl segment overlap]"
+		" [-tiles tile directory] [-ch c|ms] [--stats] [--trace trace file]\n"
+		" [--connect socket] <in.wav> <out.bmp>\n"
+		"       at --serve <socket> [workers]");
 		return 0;
 	}
+	if (o_i.dir == NULL) g_i.out = NULL;
+	if (server != NULL) return run_client(&p_i, &g_i, argv[argc-2], argv[argc-1], seed);
+	init_prof(stats, trace);
 	
 	t_size = p_i.height*p_i.width; // Number of data points in transform
 
@@ -79,11 +115,35 @@ int main(int argc, char* argv[])
 	transphase = malloc(t_size*sizeof(double));		// The transform phase of an individual
 
 	puts("Reading and transforming input...");
-	read_signal(fp,&header,&signal); // Read input signal into array
-	// Wavelet transform on input
-	wavelet_trans(&header, datalen, &p_i, signal, transform, transphase);
-	// Save output image of input
-	writeToImage(argv[argc-1], &p_i, transform, transphase);
+	if (chan_mode != 0 && header.n_channels > 1)
+	{
+		// Transform each channel of the input in parallel
+		max = transform_channels(fp, &header, datalen, &p_i, &signal, transform,
+				transphase, argv[argc-1]);
+		if (max < 0) return 1;
+	}
+	else
+	{
+		read_signal(fp,&header,&signal); // Read input signal into array
+		// Wavelet transform on input
+		max = wavelet_trans(&header, datalen, &p_i, signal, transform, transphase);
+	}
+	// Save output image of input, or its zoom pyramid
+	if (tile_dir != NULL)
+	{
+		if (write_tiles(tile_dir, &p_i, transform, transphase) < 0) return 1;
+	}
+	else if (writeToImage(argv[argc-1], &p_i, transform, transphase) < 0) return 1;
+	
+	// Transcribe the input if generations were requested
+	if (g_i.gens > 0 && seg_len > 0)
+	{
+		transcribe_segmented(&p_i, &g_i, signal, datalen, seed, argv[argc-1]);
+	}
+	else if (g_i.gens > 0)
+	{
+		transcribe(&header, datalen, &p_i, &g_i, signal, transform, max, argv[argc-1]);
+	}
 	
 	// Clean up and free memory
 	free(signal);	
@@ -91,11 +151,14 @@ int main(int argc, char* argv[])
 	free(transphase);
 	fclose(fp);
 
+	if (stats) prof_report(stdout);
+	if (dest_prof() < 0) return 1;
+
 	return 0;
 }
 
 // Checks the command line inputs to the program
-int check_inputs(int argc, char* argv[], process_info* pi)
+int check_inputs(int argc, char* argv[], process_info* pi, ga_info* gi)
 {
 	int i;
 	if (argc<3)
@@ -165,6 +228,211 @@ int check_inputs(int argc, char* argv[], process_info* pi)
 			i++;
 			pi->et = atof(argv[i]);
 		}
+		if (strcmp(argv[i],"-g")==0)
+		{
+			if (i>=(argc-3)) // User used -g, did not specify number of generations
+			{
+				printf("Number of generations not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->gens = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-n")==0)
+		{
+			if (i>=(argc-3)) // User used -n, did not specify population size
+			{
+				printf("Population size not specified:\n");
+				return -1;
+			}
+			i++;
+			// mutate_pop creates children four at a time
+			gi->pop_size = atoi(argv[i]) & ~3;
+			if (gi->pop_size < 4) gi->pop_size = 4;
+		}
+		if (strcmp(argv[i],"-notes")==0)
+		{
+			if (i>=(argc-3)) // User used -notes, did not specify number of notes
+			{
+				printf("Estimated number of notes not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->est_notes = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-sel")==0)
+		{
+			if (i>=(argc-3)) // User used -sel, did not specify selection strategy
+			{
+				printf("Selection strategy not specified:\n");
+				return -1;
+			}
+			i++;
+			if (strcmp(argv[i],"tournament")==0) gi->sel_type = SEL_TOURNAMENT;
+			else if (strcmp(argv[i],"rank")==0) gi->sel_type = SEL_RANK;
+			else gi->sel_type = SEL_ROULETTE;
+		}
+		if (strcmp(argv[i],"-i")==0)
+		{
+			if (i>=(argc-3)) // User used -i, did not specify number of islands
+			{
+				printf("Number of islands not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->islands = atoi(argv[i]);
+			if (gi->islands < 1) gi->islands = 1;
+		}
+		if (strcmp(argv[i],"-m")==0)
+		{
+			if (i>=(argc-3)) // User used -m, did not specify migration interval
+			{
+				printf("Migration interval not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->mig_int = atoi(argv[i]);
+			if (gi->mig_int < 1) gi->mig_int = 1;
+		}
+		if (strcmp(argv[i],"-cp")==0)
+		{
+			if (i>=(argc-3)) // User used -cp, did not specify checkpoint file
+			{
+				printf("Checkpoint file not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->ckpt = argv[i];
+		}
+		if (strcmp(argv[i],"-cpi")==0)
+		{
+			if (i>=(argc-3)) // User used -cpi, did not specify checkpoint interval
+			{
+				printf("Checkpoint interval not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->ckpt_int = atoi(argv[i]);
+			if (gi->ckpt_int < 1) gi->ckpt_int = 1;
+		}
+		if (strcmp(argv[i],"-r")==0)
+		{
+			if (i>=(argc-3)) // User used -r, did not specify file to resume from
+			{
+				printf("Resume file not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->resume = argv[i];
+		}
+		if (strcmp(argv[i],"-ls")==0)
+		{
+			if (i>=(argc-3)) // User used -ls, did not specify refinement interval
+			{
+				printf("Refinement interval not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->ls_int = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-lsk")==0)
+		{
+			if (i>=(argc-3)) // User used -lsk, did not specify songs to refine
+			{
+				printf("Songs to refine not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->ls_top = atoi(argv[i]);
+			if (gi->ls_top < 1) gi->ls_top = 1;
+		}
+		if (strcmp(argv[i],"-mf")==0)
+		{
+			if (i>=(argc-3)) // User used -mf, did not specify screening levels
+			{
+				printf("Screening levels not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->mf_levels = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-mfk")==0)
+		{
+			if (i>=(argc-3)) // User used -mfk, did not specify fraction promoted
+			{
+				printf("Fraction promoted not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->mf_keep = atof(argv[i]);
+			if (gi->mf_keep <= 0 || gi->mf_keep > 1) gi->mf_keep = 0.5;
+		}
+		if (strcmp(argv[i],"-e")==0)
+		{
+			if (i>=(argc-3)) // User used -e, did not specify number of elites
+			{
+				printf("Number of elites not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->elite = atoi(argv[i]);
+			if (gi->elite < 0) gi->elite = 0;
+		}
+		if (strcmp(argv[i],"-off")==0)
+		{
+			if (i>=(argc-3)) // User used -off, did not specify fraction replaced
+			{
+				printf("Fraction replaced not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->offspring = atof(argv[i]);
+			if (gi->offspring <= 0 || gi->offspring > 1) gi->offspring = 1;
+		}
+		if (strcmp(argv[i],"-o")==0)
+		{
+			if (i>=(argc-3)) // User used -o, did not specify output directory
+			{
+				printf("Output directory not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->out->dir = argv[i];
+		}
+		if (strcmp(argv[i],"-oe")==0)
+		{
+			if (i>=(argc-3)) // User used -oe, did not specify output interval
+			{
+				printf("Output interval not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->out->every = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-ok")==0)
+		{
+			if (i>=(argc-3)) // User used -ok, did not specify songs per output
+			{
+				printf("Songs per output not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->out->top_k = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-of")==0)
+		{
+			if (i>=(argc-3)) // User used -of, did not specify output formats
+			{
+				printf("Output formats not specified:\n");
+				return -1;
+			}
+			i++;
+			// Any combination of t (text), w (wav) and b (bmp)
+			gi->out->kinds = 0;
+			if (strchr(argv[i],'t') != NULL) gi->out->kinds |= OUT_TXT;
+			if (strchr(argv[i],'w') != NULL) gi->out->kinds |= OUT_WAV;
+			if (strchr(argv[i],'b') != NULL) gi->out->kinds |= OUT_BMP;
+		}
 		if (strcmp(argv[i],"-s")==0)
 		{
 			pi->sqrtt = 1;
@@ -177,6 +445,148 @@ int check_inputs(int argc, char* argv[], process_info* pi)
 		{
 			pi->us = 1;
 		}
+		if (strcmp(argv[i],"-ust")==0) // Undersample with a given error tolerance
+		{
+			if (i>=(argc-3)) // User used -ust, did not specify a tolerance
+			{
+				printf("Undersampling tolerance not specified:\n");
+				return -1;
+			}
+			i++;
+			pi->us = 1;
+			pi->tol = atof(argv[i]);
+		}
+		if (strcmp(argv[i],"-rand")==0) // Start from random songs
+		{
+			gi->seed = 0;
+		}
+		if (strcmp(argv[i],"--stats")==0)
+		{
+			stats = 1;
+		}
+		if (strcmp(argv[i],"-q")==0) // Quantize to an estimated tempo
+		{
+			gi->quant = 1;
+		}
+		if (strcmp(argv[i],"-bpm")==0)
+		{
+			if (i>=(argc-3)) // User used -bpm, did not specify a tempo
+			{
+				printf("Tempo not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->quant = 1;
+			gi->bpm = atof(argv[i]);
+		}
+		if (strcmp(argv[i],"-sub")==0)
+		{
+			if (i>=(argc-3)) // User used -sub, did not specify a subdivision
+			{
+				printf("Grid lines per beat not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->sub = atoi(argv[i]);
+		}
+		if (strcmp(argv[i],"-qj")==0)
+		{
+			if (i>=(argc-3)) // User used -qj, did not specify a jitter
+			{
+				printf("Start jitter not specified:\n");
+				return -1;
+			}
+			i++;
+			gi->jitter = atof(argv[i]);
+		}
+		if (strcmp(argv[i],"-seg")==0)
+		{
+			if (i>=(argc-3)) // User used -seg, did not specify a length
+			{
+				printf("Segment length not specified:\n");
+				return -1;
+			}
+			i++;
+			seg_len = atof(argv[i]);
+			if (seg_len <= 0)
+			{
+				printf("Segment length must be positive:\n");
+				return -1;
+			}
+		}
+		if (strcmp(argv[i],"-ovl")==0)
+		{
+			if (i>=(argc-3)) // User used -ovl, did not specify an overlap
+			{
+				printf("Segment overlap not specified:\n");
+				return -1;
+			}
+			i++;
+			seg_ovl = atof(argv[i]);
+		}
+		if (strcmp(argv[i],"-tiles")==0)
+		{
+			if (i>=(argc-3)) // User used -tiles, did not specify a directory
+			{
+				printf("Tile directory not specified:\n");
+				return -1;
+			}
+			i++;
+			tile_dir = argv[i];
+		}
+		if (strcmp(argv[i],"-ch")==0)
+		{
+			if (i>=(argc-3)) // User used -ch, did not specify channel images
+			{
+				printf("Channel images not specified:\n");
+				return -1;
+			}
+			i++;
+			// c (each channel) or ms (mid and side of a stereo input)
+			if (strcmp(argv[i],"c")==0) chan_mode = 1;
+			else if (strcmp(argv[i],"ms")==0) chan_mode = 2;
+			else
+			{
+				printf("Unknown channel images %s:\n", argv[i]);
+				return -1;
+			}
+		}
+		if (strcmp(argv[i],"--connect")==0)
+		{
+			if (i>=(argc-3)) // User used --connect, did not specify a socket
+			{
+				printf("Daemon socket not specified:\n");
+				return -1;
+			}
+			i++;
+			server = argv[i];
+		}
+		if (strcmp(argv[i],"--trace")==0)
+		{
+			if (i>=(argc-3)) // User used --trace, did not specify a file
+			{
+				printf("Trace file not specified:\n");
+				return -1;
+			}
+			i++;
+			trace = argv[i];
+		}
+	}
+	
+	// Each island evolves at least 4 songs (mutate_pop makes children in fours)
+	if (gi->islands > 1 && gi->pop_size/gi->islands < 4)
+	{
+		printf("Population of %d is too small for %d islands of 4 songs:\n", gi->pop_size,
+				gi->islands);
+		return -1;
+	}
+	
+	// Each segment must get past the overlap it shares with the next
+	if (seg_len > 0 && (seg_ovl < 0 || seg_ovl >= seg_len))
+	{
+		printf("Segment overlap of %g s must be at least 0 and less than the segment "
+				"length of %g s:\n", seg_ovl, seg_len);
+		return -1;
 	}
 	
 	printf("Generating a %dx%d image with beta=%g.\n",pi->width,pi->height,pi->b1);
@@ -196,175 +606,275 @@ void print_arr(double arr[], int s)
 	printf("]\n");
 }
 
-// Evaluate convolution of wavelet arr (of length s) with signal sig (of length datalen)
-// centered at sample i of signal
-double conv(double arr[], int s, int* sig, int datalen, int i)
+// Evolves a population of songs whose transforms approach the goal transform,
+// then saves the best song as a text file next to the output image.
+// signal is the input, goal its transform and goal_max the maximum of the goal
+// transform before it was normalized.
+void transcribe(wav_info* header, int datalen, process_info* pi, ga_info* gi,
+		int* signal, double* goal, double goal_max, char* outname)
 {
-	int j, elnum;
-	double sum = 0;
-	for (j=0; j<s; j++)
+	int failed;
+	int** notes;
+	char* filename;
+	song best;
+	eval_info ev;
+	fit_cache cache;
+	process_info epi;
+	kernel_bank kb;
+	note_grid grid;
+	
+	puts("Loading piano notes...");
+	if (init_piano(&notes, "notes") < 0) return;
+	
+	// Set up fitness evaluation against the input transform. Rendered songs are
+	// divided by the input's maximum (rather than their own) so that they are on
+	// the same scale as the goal and each column can be calculated on its own.
+	epi = *pi;
+	epi.norm = goal_max;
+	init_kernels(&kb, header, datalen, &epi);
+	init_eval(&ev, header, datalen, &epi, &kb, goal, notes);
+	ev.cache = &cache;
+	// Screen songs on smaller transforms before scoring them in full
+	init_coarse(&ev, signal, gi->mf_levels, gi->mf_keep);
+	// Room for a few generations worth of individuals
+	init_cache(&cache, gi->pop_size*8);
+	gi->ev = &ev;
+	
+	// Keep note times on a tempo grid if asked to
+	if (gi->quant)
 	{
-		elnum = i-(s>>1)+j; // elnum is centered around 0
-		if (elnum>=0 && elnum<datalen) // Prevent exceeding bounds of sig array
+		if (init_grid(&grid, gi->bpm, gi->sub, gi->jitter, goal, &epi, datalen) < 0)
 		{
-			sum += (arr[j]*sig[elnum]);
+			puts("Could not find a tempo in the input: note times will not be quantized.");
+		}
+		else
+		{
+			printf("Quantizing note times to %g bpm with %d lines per beat.\n", grid.bpm,
+					gi->sub);
+			// See estimate_tempo: a slow piece is found at double its tempo
+			if (gi->bpm <= 0 && grid.bpm/2 >= GRID_MIN_BPM)
+			{
+				printf("The tempo was estimated: if the piece is at %g bpm, give it with "
+						"-bpm.\n", grid.bpm/2);
+			}
+			gi->grid = &grid;
 		}
 	}
-
-	return sum;
+	
+	// Start from the notes that can be seen in the input's transform
+	if (gi->seed && gi->resume == NULL)
+	{
+		gi->nseeds = find_notes(goal, &epi, header, &gi->seeds);
+		printf("Found %d notes in the input.\n", gi->nseeds);
+	}
+	
+	puts("Transcribing...");
+	if (gi->out != NULL && start_output(gi->out, &ev) < 0) gi->out = NULL;
+	if (gi->islands > 1)
+	{
+		if (gi->ckpt != NULL || gi->resume != NULL || gi->out != NULL)
+		{
+			puts("Checkpoints and song output are only supported for a single population.");
+		}
+		// Evolve separate populations in parallel processes
+		failed = run_islands(gi, datalen, &best);
+	}
+	else
+	{
+		failed = evolve(gi, datalen, &best);
+	}
+	
+	if (gi->out != NULL) stop_output(gi->out);
+	
+	// Save best individual
+	if (!failed)
+	{
+		filename = malloc(strlen(outname)+5);
+		change_ext(filename, outname, ".txt");
+		write_song(&best, filename);
+		printf("Best transcription written to %s.\n", filename);
+		free(filename);
+		dest_song(&best);
+	}
+	
+	// Clean up and free memory
+	free(gi->seeds);
+	dest_eval(&ev);
+	dest_kernels(&kb);
+	dest_cache(&cache);
+	gi->ev = NULL;
+	gi->grid = NULL;
+	dest_piano(notes);
 }
 
-// Performs wavelet transform
-int wavelet_trans(wav_info* header, int datalen, process_info* pi,
-		int* signal, double* tform, double* tphase)
+// Reads each channel of the input and transforms them in parallel, giving the mono
+// signal and its transform as read_signal and wavelet_trans would, and writes an
+// image next to outname of each channel's transform (name_ch0.bmp, ...) or, for a
+// stereo input with chan_mode 2, of its side (name_side.bmp: the main image is the
+// mid, the channels' sum). Returns the largest magnitude of the mono transform, or
+// -1 if an image could not be written.
+double transform_channels(FILE* fp, wav_info* header, int datalen, process_info* pi,
+		int** signal, double* tform, double* tphase, char* outname)
 {
-	int x, y, i, last_eval_i, s_frac;
-	double T, b, s, A, r, j, max=0, timelen;
-	int N, mid;
+	int k, err = 0, n = header->n_channels, t_size = pi->width*pi->height;
+	int** chans = malloc(n*sizeof(int*));
+	double** tforms = malloc(n*sizeof(double*));
+	double** tphases = malloc(n*sizeof(double*));
+	double gains[2] = { 1, -1 };
+	double max;
+	char* name = malloc(strlen(outname)+32);
+	char ext[32];
 	
-	double *w_r, *w_j;
+	read_channels(fp, header, chans, signal);
+	for (k=0; k<n; k++)
+	{
+		tforms[k] = malloc(t_size*sizeof(double));
+		tphases[k] = malloc(t_size*sizeof(double));
+	}
+	max = wavelet_channels(header, datalen, pi, chans, tforms, tphases, tform, tphase);
 	
-	// Change start/end times if invalid
-	timelen = ((double)datalen)/header->sample_rate;
-	if (pi->st < 0) pi->st = 0;
-	if (pi->et > timelen)
+	if (chan_mode == 2 && n == 2)
 	{
-		pi->et = timelen;
-		//printf("Changed end time to %g seconds.\n", pi->et);
+		// Side: the difference of the channels, reusing the first's arrays
+		mix_channels(pi, tforms, tphases, gains, 2, tforms[0], tphases[0]);
+		change_ext(name, outname, "_side.bmp");
+		if (writeToImage(name, pi, tforms[0], tphases[0]) < 0) err = -1;
 	}
-
-	b = pi->b1;
-	for (y=0; y<pi->height; y++)
+	else
 	{
-		// Period of wavelet: set up so the highest frequency is at the top of image
-		// and the lowest frequency is at the bottom
-		T = header->sample_rate/
-				(baseF*pow(2.0,((double)y)/pi->height*W_KEYS/12));
-		// Std deviation of gaussian envelope: proportional to period
-		s = T*b;
-		// Undersampling rate: no need to evaluate at points much closer together
-		// than the std deviation 
-		s_frac = (int)s>>1;
-		// Wavelet amplitude: 1/s negates the convolution value being proportional
-		// to s
-		A = 1/s;
-		// Length in samples of wavelet
-		N = ((int)s)*8 + 1;
-		// Midpoint of wavelet in samples
-		mid = (N-1)/2;
-
-		// Calculate real and imaginary wavelet values
-		w_r = malloc(N*sizeof(double));
-		w_j = malloc(N*sizeof(double));	
-		for (i=0; i<N; i++)
-		{
-			w_r[i] = A*exp(-((long long)(i-mid))*(i-mid)/(s*s))*cos(2*PI/T*(i-mid));
-			w_j[i] = A*exp(-((long long)(i-mid))*(i-mid)/(s*s))*sin(2*PI/T*(i-mid));
-		}
-		
-		// Large negative initial value for last evaluated sample so the first
-		// will always be evaluated
-		last_eval_i = -header->sample_rate*20;
-
-		for (x=0; x<pi->width; x++)
-		{
-			// Sample number to evaluate convolution at
-			i = (x*(pi->et-pi->st)/pi->width+pi->st)*header->sample_rate;
-			// If undersampling is specified, only recalculate convolution values
-			// if the last evaluated sample number was more than s_frac samples ago
-			if (((i-last_eval_i) > s_frac) || !pi->us)
-			{
-				// Real and imaginary components
-				r = conv(w_r, N, signal, datalen, i);
-				j = conv(w_j, N, signal, datalen, i);
-				
-				// Calculate transform magnitude
-				tform[y*pi->width+x] = sqrt(r*r+j*j);
-				if (tform[y*pi->width+x] > max)
-				{
-					max = tform[y*pi->width+x];
-				}
-				// Calculate transform phase angle
-				tphase[y*pi->width+x] = atan2(j,r);
-				
-				last_eval_i = i;
-			}
-			else // To save calculation time, use previous values if undersampling
-			{
-				tform[y*pi->width+x] = tform[y*pi->width+x-1];
-				tphase[y*pi->width+x] = tphase[y*pi->width+x-1];
-			}
+		if (chan_mode == 2) printf("Mid and side need a stereo input: writing each channel.\n");
+		for (k=0; k<n && err == 0; k++)
+		{
+			sprintf(ext, "_ch%d.bmp", k);
+			change_ext(name, outname, ext);
+			if (writeToImage(name, pi, tforms[k], tphases[k]) < 0) err = -1;
 		}
-
-		free(w_r);
-		free(w_j);
 	}
-	// Make maximum value of transform 1
-	normalize_transform(tform, pi->width*pi->height, max);
 	
-	return 1;
+	for (k=0; k<n; k++)
+	{
+		free(chans[k]);
+		free(tforms[k]);
+		free(tphases[k]);
+	}
+	free(chans);
+	free(tforms);
+	free(tphases);
+	free(name);
+	return (err < 0) ? -1 : max;
 }
 
-// Normalizes the transform values so the maximum is 1 by dividing all by the maximum
-void normalize_transform(double* tform, int t_size, double max)
+// Copies filename src to dst, replacing its extension with ext
+// (dst must have room for strlen(src)+strlen(ext)+1 characters)
+void change_ext(char* dst, char* src, char* ext)
 {
-	int i;
-	if (max!=0)
+	char* dot;
+	strcpy(dst, src);
+	dot = strrchr(dst, '.');
+	// Only treat a dot in the last path component as an extension
+	if (dot != NULL && strchr(dot, '/') == NULL) *dot = 0;
+	strcat(dst, ext);
+}
+
+// Sets the library options opt to the command line's settings
+static void make_options(process_info* pi, ga_info* gi, unsigned long long seed,
+		at_options* opt)
+{
+	*opt = (at_options){ .width = pi->width, .height = pi->height, .st = pi->st,
+		.et = pi->et, .b1 = pi->b1, .us = pi->us, .tol = pi->tol, .gens = gi->gens,
+		.pop_size = gi->pop_size, .est_notes = gi->est_notes, .sel_type = gi->sel_type,
+		.tour_size = gi->tour_size, .seed = gi->seed, .ls_int = gi->ls_int, .ls_top = gi->ls_top,
+		.mf_levels = gi->mf_levels, .mf_keep = gi->mf_keep, .elite = gi->elite,
+		.offspring = gi->offspring, .quant = gi->quant, .bpm = gi->bpm, .sub = gi->sub,
+		.jitter = gi->jitter, .rng_seed = seed };
+}
+
+// Makes path absolute, relative to the current directory, in dst (of DAEMON_LINE
+// characters). Returns -1 if it does not fit.
+static int abs_path(char* dst, char* path)
+{
+	int n;
+	if (path[0] == '/') n = snprintf(dst, DAEMON_LINE, "%s", path);
+	else if (getcwd(dst, DAEMON_LINE) == NULL) return -1;
+	else n = strlen(dst) + snprintf(dst+strlen(dst), DAEMON_LINE-strlen(dst), "/%s", path);
+	return (n < DAEMON_LINE-4) ? 0 : -1; // Leaves room to change the extension
+}
+
+// Sends the job to the daemon at server instead of running it here: the daemon
+// writes the input's transform to out and, if generations were requested, the
+// transcription next to it. Returns the program's exit status.
+int run_client(process_info* pi, ga_info* gi, char* in, char* out,
+		unsigned long long seed)
+{
+	int ret;
+	char reply[DAEMON_LINE+256];
+	job_info* job;
+	
+	if (gi->islands > 1 || gi->ckpt != NULL || gi->resume != NULL || gi->out != NULL)
 	{
-		for (i=0; i<t_size; i++)
-		{
-			tform[i] /= max;
-		}
+		puts("Islands, checkpoints and song output are not supported by the daemon.");
+		return 1;
+	}
+	if (seg_len > 0 || tile_dir != NULL || chan_mode != 0)
+	{
+		puts("Segments, tiles and channel images are not supported by the daemon.");
+		return 1;
+	}
+	job = calloc(1, sizeof(job_info));
+	if (abs_path(job->in, in) < 0 || abs_path(job->image, out) < 0)
+	{
+		puts("File name too long.");
+		free(job);
+		return 1;
 	}
+	if (gi->gens > 0) change_ext(job->song, job->image, ".txt");
+	job->phase = pi->phase;
+	make_options(pi, gi, seed, &job->opt);
+	
+	ret = submit_job(server, job, reply, sizeof(reply));
+	puts(reply);
+	free(job);
+	return (ret < 0) ? 1 : 0;
 }
 
-// Write transform to image
-void writeToImage(char* filename, process_info* pi, double* tform, double* tphase)
+// Transcribes the input in overlapping segments on every processor (see
+// transcribe_segments), then saves the stitched song as a text file next to
+// the output image
+void transcribe_segmented(process_info* pi, ga_info* gi, int* signal, int datalen,
+		unsigned long long seed, char* outname)
 {
-	FILE* gen_bmp;
-	int x, y;
-	struct HSL hsl;
-	struct RGB rgb;
+	int err;
+	char* filename;
+	song best;
+	at_bank* bank;
+	at_options opt;
+	seg_info si = { .len = seg_len, .overlap = seg_ovl,
+		.threads = sysconf(_SC_NPROCESSORS_ONLN), .verbose = 1 };
 	
-	// Open output bmp file
-	gen_bmp = fopen(filename,"w");
-	if (gen_bmp<0)
+	if (gi->islands > 1 || gi->ckpt != NULL || gi->resume != NULL || gi->out != NULL)
 	{
-		perror("Error opening output file"); 
-		exit(errno);
+		puts("Islands, checkpoints and song output are not supported with segments.");
+		return;
 	}
-	// Write file header
-	write_bmp_header(gen_bmp, pi->height, pi->width);
-	
-	// Write scaled values to image
-	hsl.S = 1;
+	puts("Loading piano notes...");
+	bank = at_load_bank("notes", &err);
+	if (bank == NULL) return;
+	make_options(pi, gi, seed, &opt);
 	
-	// Write pixels
-	for (y=0;y<pi->height;y++)
+	puts("Transcribing in segments...");
+	err = transcribe_segments(bank, &opt, signal, datalen, &si, &best);
+	if (err < 0)
 	{
-		for (x=0;x<pi->width;x++)
-		{
-			// If phase coloring specified
-			if (pi->phase)
-			{
-				// Turn phase into a hue
-				hsl.H = (tphase[y*pi->width+x]+PI)/(2*PI);
-				// Brightness is proportional to the transform magnitude
-				hsl.L = tform[y*pi->width+x]/2;
-				// Convert hue, saturation, and lum to RGB
-				toRGB(&hsl,&rgb);
-			}
-			else
-			{
-				// Grayscale with brightness proportional to the transform magnitude
-				rgb.R = rgb.G = rgb.B = (float)(tform[y*pi->width+x]);
-			}
-			// Write pixel
-			write_color(&rgb,gen_bmp);
-		}
-		// Write bitmap line padding
-		writeZeros(pi->width%4, gen_bmp);
+		printf("Segmented transcription failed: %s.\n", at_strerror(err));
+	}
+	else
+	{
+		filename = malloc(strlen(outname)+5);
+		change_ext(filename, outname, ".txt");
+		write_song(&best, filename);
+		printf("Best transcription written to %s.\n", filename);
+		free(filename);
 	}
-	fclose(gen_bmp);
+	dest_song(&best);
+	at_free_bank(bank);
 }
-
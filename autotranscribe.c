@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "autotranscribe.h"
+#include "piano.h"
+#include "transform.h"
+#include "bmp_write.h"
+#include "eval.h"
+#include "ga.h"
+#include "seed.h"
+#include "synth.h"
+#include "rng.h"
+
+// Wavelets for one height, beta and sample rate
+typedef struct kernel_set
+{
+	int height;
+	double b1;
+	int rate;
+	int ready;		// 0 while kb is being built
+	kernel_bank kb;
+} kernel_set;
+
+// Piano notes and wavelets shared by contexts
+struct at_bank
+{
+	int** notes;	// notes[key]: see init_piano
+	kernel_set sets[AT_KERNEL_SETS];	// Wavelets built so far, never changed once ready
+	int nsets;
+	pthread_mutex_t lock;	// Guards nsets and the sets' keys and ready flags
+	pthread_cond_t built;	// Signalled when a set becomes ready
+};
+
+// One transcription's settings and input
+struct at_ctx
+{
+	at_bank* bank;		// Shared notes and wavelets (not owned)
+	at_options opt;
+	process_info pi;	// Transform settings from opt, adjusted to the input by clamp_times
+	wav_info header;	// Header of the input
+	int* signal;		// Input (NULL: none yet)
+	int datalen;		// Length of the input in samples
+	kernel_bank* kb;	// Wavelets for pi (NULL: not found yet)
+	kernel_bank own;	// Wavelets built for this context when the bank keeps no more
+};
+
+static char* err_names[] = { "success", "file could not be read",
+	"unsupported wav file", "out of memory", "invalid argument",
+	"no input given" };
+
+// Loads the piano sound files 0.wav to 87.wav from the folder dir. Returns NULL
+// and sets err if they could not be read.
+at_bank* at_load_bank(char* dir, int* err)
+{
+	at_bank* bank = malloc(sizeof(at_bank));
+	if (bank == NULL)
+	{
+		*err = AT_ERR_NOMEM;
+		return NULL;
+	}
+	if (init_piano(&bank->notes, dir) < 0)
+	{
+		free(bank);
+		*err = AT_ERR_IO;
+		return NULL;
+	}
+	bank->nsets = 0;
+	pthread_mutex_init(&bank->lock, NULL);
+	pthread_cond_init(&bank->built, NULL);
+	*err = 0;
+	return bank;
+}
+
+// Makes a bank of synthetic notes (see synth_piano), for use without sound files
+at_bank* at_synth_bank(int* err)
+{
+	at_bank* bank = malloc(sizeof(at_bank));
+	if (bank == NULL)
+	{
+		*err = AT_ERR_NOMEM;
+		return NULL;
+	}
+	synth_piano(&bank->notes);
+	bank->nsets = 0;
+	pthread_mutex_init(&bank->lock, NULL);
+	pthread_cond_init(&bank->built, NULL);
+	*err = 0;
+	return bank;
+}
+
+// Frees a bank once no context uses it
+void at_free_bank(at_bank* bank)
+{
+	int i;
+	if (bank == NULL) return;
+	for (i=0; i < bank->nsets; i++)
+	{
+		dest_kernels(&bank->sets[i].kb);
+	}
+	pthread_mutex_destroy(&bank->lock);
+	pthread_cond_destroy(&bank->built);
+	dest_piano(bank->notes);
+	free(bank);
+}
+
+// Finds the bank's wavelets for pi at the input's sample rate, building them
+// if the bank has room. Returns NULL if it has none and no room. A set is built
+// without holding the lock, so only contexts that need that set wait for it.
+static kernel_bank* bank_kernels(at_bank* bank, wav_info* header, int datalen,
+		process_info* pi)
+{
+	int i;
+	kernel_set* ks;
+	kernel_bank* kb = NULL;
+	process_info p = *pi;
+
+	pthread_mutex_lock(&bank->lock);
+	for (i=0; i < bank->nsets && kb == NULL; i++)
+	{
+		ks = &bank->sets[i];
+		if (ks->height == pi->height && ks->b1 == pi->b1 && ks->rate == header->sample_rate)
+		{
+			while (!ks->ready)
+			{
+				pthread_cond_wait(&bank->built, &bank->lock);
+			}
+			kb = &ks->kb;
+		}
+	}
+	if (kb == NULL && bank->nsets < AT_KERNEL_SETS)
+	{
+		ks = &bank->sets[bank->nsets];
+		ks->height = pi->height;
+		ks->b1 = pi->b1;
+		ks->rate = header->sample_rate;
+		ks->ready = 0;
+		bank->nsets++;
+		pthread_mutex_unlock(&bank->lock);
+
+		init_kernels(&ks->kb, header, datalen, &p);
+
+		pthread_mutex_lock(&bank->lock);
+		ks->ready = 1;
+		kb = &ks->kb;
+		pthread_cond_broadcast(&bank->built);
+	}
+	pthread_mutex_unlock(&bank->lock);
+	return kb;
+}
+
+// Sets opt to the command line program's defaults, with 100 generations
+void at_default_options(at_options* opt)
+{
+	opt->width = 1000;
+	opt->height = W_KEYS;
+	opt->st = 0;
+	opt->et = 15;
+	opt->b1 = 16;
+	opt->us = 0;
+	opt->tol = 0;
+	opt->gens = 100;
+	opt->pop_size = 100;
+	opt->est_notes = 20;
+	opt->sel_type = SEL_ROULETTE;
+	opt->tour_size = 2;
+	opt->seed = 1;
+	opt->ls_int = 0;
+	opt->ls_top = 1;
+	opt->mf_levels = 0;
+	opt->mf_keep = 0.5;
+	opt->elite = 0;
+	opt->offspring = 1;
+	opt->quant = 0;
+	opt->bpm = 0;
+	opt->sub = GRID_SUB;
+	opt->jitter = 0;
+	opt->rng_seed = 1;
+}
+
+// Drops the context's wavelets: they are found again when next needed
+static void drop_kernels(at_ctx* ctx)
+{
+	if (ctx->kb == &ctx->own) dest_kernels(&ctx->own);
+	ctx->kb = NULL;
+}
+
+// Sets up the transform settings for the context's options and input and
+// finds their wavelets, unless that has been done
+static int need_kernels(at_ctx* ctx)
+{
+	if (ctx->signal == NULL) return AT_ERR_NOINPUT;
+	if (ctx->kb != NULL) return 0;
+	ctx->pi = (process_info){ .height = ctx->opt.height, .width = ctx->opt.width,
+			.st = ctx->opt.st, .et = ctx->opt.et, .b1 = ctx->opt.b1, .b2 = 1,
+			.sqrtt = 0, .phase = 0, .us = ctx->opt.us, .tol = ctx->opt.tol,
+			.norm = 0 };
+	clamp_times(&ctx->header, ctx->datalen, &ctx->pi);
+	ctx->kb = bank_kernels(ctx->bank, &ctx->header, ctx->datalen, &ctx->pi);
+	if (ctx->kb == NULL)
+	{
+		init_kernels(&ctx->own, &ctx->header, ctx->datalen, &ctx->pi);
+		ctx->kb = &ctx->own;
+	}
+	return 0;
+}
+
+// Makes a context that renders songs with bank (which must outlive it) and
+// uses the options opt. Returns NULL and sets err on failure.
+at_ctx* at_new(at_bank* bank, at_options* opt, int* err)
+{
+	at_ctx* ctx;
+	if (bank == NULL)
+	{
+		*err = AT_ERR_ARG;
+		return NULL;
+	}
+	ctx = calloc(1, sizeof(at_ctx));
+	if (ctx == NULL)
+	{
+		*err = AT_ERR_NOMEM;
+		return NULL;
+	}
+	ctx->bank = bank;
+	*err = at_set_options(ctx, opt);
+	if (*err < 0)
+	{
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+// Changes the options of a context. Returns AT_ERR_ARG if they are invalid.
+int at_set_options(at_ctx* ctx, at_options* opt)
+{
+	if (opt->width < 1 || opt->height < 1 || opt->b1 <= 0 || opt->st < 0 ||
+			opt->et <= opt->st || opt->us < 0 || opt->tol < 0 || opt->gens < 0 ||
+			opt->pop_size < 4 || opt->est_notes < 1 || opt->sel_type < SEL_ROULETTE ||
+			opt->sel_type > SEL_RANK || opt->tour_size < 1 || opt->ls_int < 0 ||
+			opt->ls_top < 0 || opt->mf_levels < 0 || opt->mf_keep <= 0 ||
+			opt->mf_keep > 1 || opt->elite < 0 || opt->offspring <= 0 ||
+			opt->offspring > 1 || opt->bpm < 0 || opt->sub < 1 || opt->jitter < 0)
+	{
+		return AT_ERR_ARG;
+	}
+	ctx->opt = *opt;
+	ctx->opt.pop_size &= ~3;
+	drop_kernels(ctx);
+	return 0;
+}
+
+// Reads the context's input from a wav file, adding its channels together.
+// Songs are rendered from notes sampled at FS, so the file must be too.
+int at_read_input(at_ctx* ctx, char* filename)
+{
+	FILE* fp;
+	wav_info header;
+
+	if (open_wav_r(filename, &fp) < 0) return AT_ERR_IO;
+	if (check_wav_header(fp, &header) < 0 || header.sample_rate != FS)
+	{
+		fclose(fp);
+		return AT_ERR_FORMAT;
+	}
+	free(ctx->signal);
+	read_signal(fp, &header, &ctx->signal);
+	fclose(fp);
+	ctx->header = header;
+	ctx->datalen = get_data_len(&header);
+	drop_kernels(ctx);
+	return 0;
+}
+
+// Copies datalen samples of signal, sampled at sample_rate (which must be FS,
+// like the notes songs are rendered from), to be the context's input
+int at_set_input(at_ctx* ctx, int* signal, int datalen, int sample_rate)
+{
+	int* copy;
+
+	if (signal == NULL || datalen < 1 || sample_rate != FS) return AT_ERR_ARG;
+	copy = malloc(datalen*sizeof(int));
+	if (copy == NULL) return AT_ERR_NOMEM;
+	memcpy(copy, signal, datalen*sizeof(int));
+	free(ctx->signal);
+	ctx->signal = copy;
+	ctx->datalen = datalen;
+	synth_header(&ctx->header, datalen);
+	drop_kernels(ctx);
+	return 0;
+}
+
+// Transforms the context's input into tform (width*height values, row by row,
+// with a maximum of 1) and, unless it is NULL, its phase into tphase
+int at_transform(at_ctx* ctx, double* tform, double* tphase)
+{
+	double max;
+	int ret = need_kernels(ctx);
+
+	if (ret < 0) return ret;
+	max = wavelet_cols(ctx->kb, &ctx->header, ctx->datalen, &ctx->pi, ctx->signal,
+			0, ctx->pi.width, tform, tphase);
+	normalize_transform(tform, ctx->pi.width*ctx->pi.height, max);
+	return 0;
+}
+
+// Writes the transform of the context's input to a bitmap, coloured by phase
+// if phase is set
+int at_write_transform(at_ctx* ctx, char* filename, int phase)
+{
+	int ret = need_kernels(ctx), tsize = ctx->opt.width*ctx->opt.height;
+	double* tform = malloc(tsize*sizeof(double));
+	double* tphase = phase ? malloc(tsize*sizeof(double)) : NULL;
+	process_info pi;
+
+	if (ret == 0 && (tform == NULL || (phase && tphase == NULL))) ret = AT_ERR_NOMEM;
+	if (ret == 0) ret = at_transform(ctx, tform, tphase);
+	if (ret == 0)
+	{
+		pi = ctx->pi;
+		pi.phase = phase;
+		if (writeToImage(filename, &pi, tform, tphase) < 0) ret = AT_ERR_IO;
+	}
+	free(tform);
+	free(tphase);
+	return ret;
+}
+
+// Renders s as long as the context's input into a new signal, setting datalen
+// to its length
+int at_render(at_ctx* ctx, song* s, int** signal, int* datalen)
+{
+	if (ctx->signal == NULL) return AT_ERR_NOINPUT;
+	render_music(s, ctx->bank->notes, signal, &ctx->header);
+	if (*signal == NULL) return AT_ERR_NOMEM;
+	*datalen = get_data_len(&ctx->header);
+	return 0;
+}
+
+// Transforms the context's input into a new goal for scoring songs (normalized,
+// with epi, a copy of the context's settings, holding the input's maximum).
+// Returns NULL if there is no memory.
+static double* input_goal(at_ctx* ctx, process_info* epi)
+{
+	int tsize = ctx->pi.width*ctx->pi.height;
+	double* goal = malloc(tsize*sizeof(double));
+
+	if (goal == NULL) return NULL;
+	*epi = ctx->pi;
+	epi->norm = wavelet_cols(ctx->kb, &ctx->header, ctx->datalen, epi, ctx->signal,
+			0, epi->width, goal, NULL);
+	normalize_transform(goal, tsize, epi->norm);
+	return goal;
+}
+
+// Scores s against the context's input in full, setting its error and fitness
+// as at_transcribe would
+int at_score(at_ctx* ctx, song* s)
+{
+	int ret = need_kernels(ctx);
+	double* goal;
+	process_info epi;
+	eval_info ev;
+
+	if (ret < 0) return ret;
+	goal = input_goal(ctx, &epi);
+	if (goal == NULL) return AT_ERR_NOMEM;
+	init_eval(&ev, &ctx->header, ctx->datalen, &epi, ctx->kb, goal, ctx->bank->notes);
+	ev.bound = HUGE_VAL; // Finish songs worse than silence too
+	eval_song(s, &ev);
+	dest_eval(&ev);
+	free(goal);
+	return 0;
+}
+
+// Transcribes the context's input, setting best to the best song found (free
+// it with at_free_song). Evolution runs on the calling thread from opt.rng_seed,
+// so the same options and input give the same song.
+int at_transcribe(at_ctx* ctx, song* best)
+{
+	int ret = need_kernels(ctx);
+	double* goal;
+	process_info epi;
+	eval_info ev;
+	fit_cache cache;
+	ga_info gi;
+	note_grid grid;
+
+	if (ret < 0) return ret;
+	// Score songs against the input's transform, as transcribe does
+	goal = input_goal(ctx, &epi);
+	if (goal == NULL) return AT_ERR_NOMEM;
+	init_eval(&ev, &ctx->header, ctx->datalen, &epi, ctx->kb, goal, ctx->bank->notes);
+	init_cache(&cache, ctx->opt.pop_size*8);
+	ev.cache = &cache;
+	init_coarse(&ev, ctx->signal, ctx->opt.mf_levels, ctx->opt.mf_keep);
+
+	// A single population with no checkpoints, output or progress messages
+	memset(&gi, 0, sizeof(ga_info));
+	gi.sel_type = ctx->opt.sel_type;
+	gi.tour_size = ctx->opt.tour_size;
+	gi.ev = &ev;
+	gi.gens = ctx->opt.gens;
+	gi.pop_size = ctx->opt.pop_size;
+	gi.est_notes = ctx->opt.est_notes;
+	gi.islands = 1;
+	gi.ls_int = ctx->opt.ls_int;
+	gi.ls_top = ctx->opt.ls_top;
+	gi.mf_levels = ctx->opt.mf_levels;
+	gi.mf_keep = ctx->opt.mf_keep;
+	gi.elite = ctx->opt.elite;
+	gi.offspring = ctx->opt.offspring;
+	if (ctx->opt.quant && init_grid(&grid, ctx->opt.bpm, ctx->opt.sub, ctx->opt.jitter,
+			goal, &epi, ctx->datalen) == 0)
+	{
+		gi.grid = &grid; // Without a tempo, note times are not quantized
+	}
+	if (ctx->opt.seed) gi.nseeds = find_notes(goal, &epi, &ctx->header, &gi.seeds);
+
+	rng_seed(ctx->opt.rng_seed);
+	ret = evolve(&gi, ctx->datalen, best) < 0 ? AT_ERR_ARG : 0;
+
+	free(gi.seeds);
+	dest_eval(&ev);
+	dest_cache(&cache);
+	free(goal);
+	return ret;
+}
+
+// Frees a context (but not its bank)
+void at_free(at_ctx* ctx)
+{
+	if (ctx == NULL) return;
+	drop_kernels(ctx);
+	free(ctx->signal);
+	free(ctx);
+}
+
+// Describes an error code
+const char* at_strerror(int err)
+{
+	if (err > 0 || err < AT_ERR_NOINPUT) return "unknown error";
+	return err_names[-err];
+}
+
+// Makes s an empty song
+void at_init_song(song* s)
+{
+	init_song(s);
+}
+
+// Adds note n to s, keeping its notes in start time order
+void at_add_note(song* s, note n)
+{
+	add_note(n, s);
+}
+
+// Saves s to a text file. Returns AT_ERR_IO if it could not be written.
+int at_write_song(song* s, char* filename)
+{
+	return (write_song(s, filename) < 0) ? AT_ERR_IO : 0;
+}
+
+// Frees the notes of s
+void at_free_song(song* s)
+{
+	dest_song(s);
+}
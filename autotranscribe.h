@@ -0,0 +1,78 @@
+#ifndef AUTOTRANSCRIBE
+#define AUTOTRANSCRIBE
+
+#include "song.h"
+#include "selection.h"
+
+// libautotranscribe: transcription without the command line. A bank of piano
+// notes is loaded once and shared by any number of contexts, which also reuse
+// the wavelets it keeps; each context holds one transcription's options and
+// input and must only be used by one thread at a time, so separate contexts
+// can run concurrently. The library exports only the functions below (AT_API);
+// songs are built, saved and freed with the at_*_song functions.
+
+// Marks the library's interface: everything else is hidden (-fvisibility=hidden)
+#define AT_API __attribute__((visibility("default")))
+
+#define AT_KERNEL_SETS 8	// Sets of wavelets a bank keeps for its contexts
+
+// Error codes (functions return 0 on success)
+#define AT_ERR_IO -1		// A file could not be opened or read
+#define AT_ERR_FORMAT -2	// The input is not a supported wav file
+#define AT_ERR_NOMEM -3		// Out of memory
+#define AT_ERR_ARG -4		// Invalid argument or option
+#define AT_ERR_NOINPUT -5	// The context has no input yet
+
+// Options of a context (see at_default_options for the defaults)
+typedef struct at_options
+{
+	int width;			// Transform width (columns)
+	int height;			// Transform height (rows)
+	double st;			// Start time of the transform in seconds
+	double et;			// End time of the transform in seconds (clamped to the input)
+	double b1;			// Beta value of the transform
+	int us;				// Whether to undersample the transform
+	double tol;			// Error allowed when undersampling (0: the default, see row_hop)
+	int gens;			// Generations to evolve
+	int pop_size;		// Population size (rounded down to a multiple of 4)
+	int est_notes;		// Notes in each initial song
+	int sel_type;		// Selection strategy (SEL_ROULETTE, SEL_TOURNAMENT or SEL_RANK)
+	int tour_size;		// Songs competing in each tournament
+	int seed;			// Whether to start from notes found in the input
+	int ls_int;			// Generations between volume refinements (0: never)
+	int ls_top;			// Best songs whose volumes are refined
+	int mf_levels;		// Coarser transforms songs are screened on (0: none)
+	double mf_keep;		// Fraction of screened songs promoted at each level
+	int elite;			// Best songs always carried over to the next generation
+	double offspring;	// Fraction of the population replaced each generation
+	int quant;			// Whether to keep note times on a tempo grid
+	double bpm;			// Tempo of the grid (0: estimate it, but slow pieces come out doubled)
+	int sub;			// Grid lines per beat
+	double jitter;		// Seconds a note may start off its grid line
+	unsigned long long rng_seed;	// Seed of the random numbers of a transcription
+} at_options;
+
+typedef struct at_bank at_bank;	// Piano notes songs are rendered with
+typedef struct at_ctx at_ctx;	// A transcription context
+
+AT_API at_bank* at_load_bank(char* dir, int* err);
+AT_API at_bank* at_synth_bank(int* err);
+AT_API void at_free_bank(at_bank* bank);
+AT_API void at_default_options(at_options* opt);
+AT_API at_ctx* at_new(at_bank* bank, at_options* opt, int* err);
+AT_API int at_set_options(at_ctx* ctx, at_options* opt);
+AT_API int at_read_input(at_ctx* ctx, char* filename);
+AT_API int at_set_input(at_ctx* ctx, int* signal, int datalen, int sample_rate);
+AT_API int at_transform(at_ctx* ctx, double* tform, double* tphase);
+AT_API int at_write_transform(at_ctx* ctx, char* filename, int phase);
+AT_API int at_render(at_ctx* ctx, song* s, int** signal, int* datalen);
+AT_API int at_transcribe(at_ctx* ctx, song* best);
+AT_API int at_score(at_ctx* ctx, song* s);
+AT_API void at_free(at_ctx* ctx);
+AT_API const char* at_strerror(int err);
+AT_API void at_init_song(song* s);
+AT_API void at_add_note(song* s, note n);
+AT_API int at_write_song(song* s, char* filename);
+AT_API void at_free_song(song* s);
+
+#endif
@@ -0,0 +1,261 @@
+// Benchmarks the main stages of transcription on synthetic inputs and prints
+// the results as JSON, so performance can be tracked across releases.
+// Usage: at_bench [results.json]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "wav_rw.h"
+#include "bmp_write.h"
+#include "song.h"
+#include "piano.h"
+#include "ga.h"
+#include "transform.h"
+#include "rng.h"
+#include "synth.h"
+
+#define BENCH_LEN (FS*5)		// Length of the synthetic inputs in samples
+#define BENCH_MIN_TIME 0.5		// Seconds each benchmark is repeated for
+#define BENCH_WAV "bench.wav"	// Scratch files written by the benchmarks
+#define BENCH_BMP "bench.bmp"
+#define BENCH_INPUTS 3
+
+// State shared by the benchmarks
+typedef struct bench_info
+{
+	wav_info header;		// Header of the synthetic inputs
+	int* input;				// Input being benchmarked
+	song* s;				// Song being benchmarked
+	process_info pi;		// Transform settings being benchmarked
+	double* tform;			// Transform buffers of up to 1000 columns by W_KEYS rows
+	double* goal;
+	ga_info* gi;			// Settings for mutate_pop
+	song* pop;				// Population for mutate_pop
+	int** notes;			// Synthetic piano bank
+} bench_info;
+
+static FILE* out;
+static int first = 1;
+
+// Seconds on a monotonic clock
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+// Runs fn until it has taken BENCH_MIN_TIME in total (and at least once).
+// Returns the fastest run in seconds and sets reps to the number of runs.
+static double time_reps(void (*fn)(bench_info*), bench_info* bi, int* reps)
+{
+	double t, start, total = 0, best = -1;
+	*reps = 0;
+	while (total < BENCH_MIN_TIME || *reps == 0)
+	{
+		start = now();
+		fn(bi);
+		t = now()-start;
+		total += t;
+		if (best < 0 || t < best) best = t;
+		(*reps)++;
+	}
+	return best;
+}
+
+// Prints one result. items is the amount of work in one run, counted in unit;
+// params is a JSON object body (may be empty).
+static void report(char* name, char* input, char* params, int reps, double secs,
+		double items, char* unit)
+{
+	fprintf(out, "%s\n    {\"name\": \"%s\", \"input\": \"%s\", \"params\": {%s}, "
+			"\"reps\": %d, \"seconds\": %.6g, \"throughput\": %.6g, \"unit\": \"%s/s\"}",
+			first ? "" : ",", name, input, params, reps, secs, items/secs, unit);
+	first = 0;
+	fprintf(stderr, "%-14s %-8s %-32s %12.4g %s/s\n", name, input, params, items/secs, unit);
+}
+
+static void run_read(bench_info* bi)
+{
+	FILE* fp;
+	wav_info header;
+	int* signal;
+	if (open_wav_r(BENCH_WAV, &fp) < 0 || check_wav_header(fp, &header) < 0) exit(1);
+	read_signal(fp, &header, &signal);
+	fclose(fp);
+	free(signal);
+}
+
+static void run_trans(bench_info* bi)
+{
+	bi->pi.norm = 0;
+	wavelet_trans(&bi->header, BENCH_LEN, &bi->pi, bi->input, bi->tform, NULL);
+}
+
+static void run_render(bench_info* bi)
+{
+	int* signal;
+	render_music(bi->s, bi->notes, &signal, &bi->header);
+	free(signal);
+}
+
+static void run_error(bench_info* bi)
+{
+	error_fn(bi->tform, bi->goal, bi->pi.width*bi->pi.height);
+}
+
+static void run_mutate(bench_info* bi)
+{
+	mutate_pop(&bi->pop, bi->gi->pop_size, BENCH_LEN, bi->gi);
+}
+
+static void run_image(bench_info* bi)
+{
+	if (writeToImage(BENCH_BMP, &bi->pi, bi->tform, NULL) < 0) exit(1);
+}
+
+// Sets up an evaluator like transcribe does, with bi->goal as the goal
+static void init_bench_eval(bench_info* bi, eval_info* ev, kernel_bank* kb, process_info* epi)
+{
+	*epi = bi->pi;
+	epi->norm = wavelet_trans(&bi->header, BENCH_LEN, epi, bi->input, bi->goal, NULL);
+	init_kernels(kb, &bi->header, BENCH_LEN, epi);
+	init_eval(ev, &bi->header, BENCH_LEN, epi, kb, bi->goal, bi->notes);
+}
+
+int main(int argc, char* argv[])
+{
+	// Transform settings: quick, the defaults at lower width, and high resolution
+	int sizes[][3] = { {200, 56, 4}, {250, W_KEYS, 16}, {1000, W_KEYS, 8} };
+	char* names[BENCH_INPUTS] = { "chords", "sweep", "passage" };
+	int* inputs[BENCH_INPUTS];
+	song songs[BENCH_INPUTS];
+	char params[128];
+	int i, j, reps, scored;
+	double secs;
+	bench_info bi;
+	ga_info gi;
+	eval_info ev;
+	kernel_bank kb;
+	process_info epi;
+
+	out = stdout;
+	if (argc > 1 && (out = fopen(argv[1], "w")) == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	// Inputs are the same from run to run
+	rng_seed(1);
+	synth_piano(&bi.notes);
+	synth_header(&bi.header, BENCH_LEN);
+	synth_chords(&songs[0], BENCH_LEN);
+	init_song(&songs[1]);
+	synth_passage(&songs[2], BENCH_LEN, 200);
+	for (i=0; i<BENCH_INPUTS; i++)
+	{
+		if (i == 1)
+		{
+			inputs[i] = malloc(BENCH_LEN*sizeof(int));
+			synth_sweep(inputs[i], BENCH_LEN);
+		}
+		else render_music(&songs[i], bi.notes, &inputs[i], &bi.header);
+	}
+	bi.tform = malloc(1000*W_KEYS*sizeof(double));
+	bi.goal = malloc(1000*W_KEYS*sizeof(double));
+	bi.pi = (process_info){ .height = W_KEYS, .width = 1000, .st = 0, .et = 15,
+			.b1 = 16, .b2 = 1, .sqrtt = 0, .phase = 0, .us = 0, .norm = 0 };
+
+	fprintf(out, "{\n  \"sample_rate\": %d, \"samples\": %d,\n  \"benchmarks\": [", FS, BENCH_LEN);
+
+	for (i=0; i<BENCH_INPUTS; i++)
+	{
+		bi.input = inputs[i];
+		if (write_wav(BENCH_WAV, &bi.header, bi.input) < 0) return 1;
+		secs = time_reps(run_read, &bi, &reps);
+		report("read_signal", names[i], "", reps, secs, BENCH_LEN, "samples");
+	}
+	remove(BENCH_WAV);
+
+	for (j=0; j<3; j++)
+	{
+		bi.pi.width = sizes[j][0];
+		bi.pi.height = sizes[j][1];
+		bi.pi.b1 = sizes[j][2];
+		sprintf(params, "\"width\": %d, \"height\": %d, \"b1\": %d",
+				sizes[j][0], sizes[j][1], sizes[j][2]);
+		for (i=0; i<BENCH_INPUTS; i++)
+		{
+			bi.input = inputs[i];
+			secs = time_reps(run_trans, &bi, &reps);
+			report("wavelet_trans", names[i], params, reps, secs,
+					(double)bi.pi.width*bi.pi.height, "points");
+		}
+	}
+
+	for (i=0; i<BENCH_INPUTS; i+=2) // The sweep is not a song
+	{
+		bi.s = &songs[i];
+		sprintf(params, "\"notes\": %d", songs[i].size);
+		secs = time_reps(run_render, &bi, &reps);
+		report("render_music", names[i], params, reps, secs, BENCH_LEN, "samples");
+	}
+
+	// Errors and images of the largest transform, which run_trans left in bi.tform
+	bi.input = inputs[2];
+	memcpy(bi.goal, bi.tform, bi.pi.width*bi.pi.height*sizeof(double));
+	bi.tform[0] += 1;
+	sprintf(params, "\"width\": %d, \"height\": %d", bi.pi.width, bi.pi.height);
+	secs = time_reps(run_error, &bi, &reps);
+	report("error_fn", "passage", params, reps, secs,
+			(double)bi.pi.width*bi.pi.height, "points");
+	secs = time_reps(run_image, &bi, &reps);
+	report("writeToImage", "passage", params, reps, secs,
+			(double)bi.pi.width*bi.pi.height, "pixels");
+	remove(BENCH_BMP);
+
+	// One generation of a small population, with and without scoring the
+	// children (scored first, while the population's column errors are valid)
+	bi.pi.width = sizes[0][0];
+	bi.pi.height = sizes[0][1];
+	bi.pi.b1 = sizes[0][2];
+	init_bench_eval(&bi, &ev, &kb, &epi);
+	memset(&gi, 0, sizeof(ga_info));
+	gi.sel_type = SEL_TOURNAMENT;
+	gi.tour_size = 2;
+	gi.pop_size = 32;
+	gi.est_notes = 20;
+	bi.gi = &gi;
+	bi.pop = malloc(gi.pop_size*sizeof(song));
+	gen_pop(bi.pop, gi.pop_size, gi.est_notes, BENCH_LEN);
+	eval_pop(bi.pop, gi.pop_size, NULL, &ev);
+	for (scored=1; scored>=0; scored--)
+	{
+		gi.ev = scored ? &ev : NULL;
+		sprintf(params, "\"population\": %d, \"notes\": %d, \"scored\": %d, "
+				"\"width\": %d, \"height\": %d", gi.pop_size, gi.est_notes, scored,
+				epi.width, epi.height);
+		secs = time_reps(run_mutate, &bi, &reps);
+		report("mutate_pop", "passage", params, reps, secs, gi.pop_size, "songs");
+	}
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout) fclose(out);
+
+	for (i=0; i < gi.pop_size; i++)
+	{
+		dest_song(&bi.pop[i]);
+	}
+	free(bi.pop);
+	dest_eval(&ev);
+	dest_kernels(&kb);
+	for (i=0; i<BENCH_INPUTS; i++)
+	{
+		free(inputs[i]);
+		dest_song(&songs[i]);
+	}
+	free(bi.tform);
+	free(bi.goal);
+	dest_piano(bi.notes);
+	return 0;
+}
@@ -1,10 +1,30 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "bmp_write.h"
 #include "file_rw.h"
+#include "transform.h"
+#include "prof.h"
 
 #define DEBUG 0
 
+// Phase colours of every quantized hue and magnitude, as BGR bytes
+static unsigned char color_lut[LUT_HUES][LUT_LEVELS+1][3];
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+
+// Rows of an image shared by the threads encoding it
+typedef struct encode_job
+{
+	process_info* pi;
+	double* tform;
+	double* tphase;
+	unsigned char* buf;	// Encoded rows, each padded to a multiple of 4 bytes
+	int y0, y1;			// Rows encoded by this thread
+} encode_job;
+
 // Writes out the bitmap header
 void write_bmp_header(FILE* fp, int h, int w)
 {
@@ -114,3 +134,161 @@ void toRGB(struct HSL* in, struct RGB* out)
 
 }
 
+// Colors a point of a normalized transform of magnitude mag: by phase if
+// use_phase is set, grayscale otherwise
+void transform_color(double mag, double phase, int use_phase, struct RGB* rgb)
+{
+	struct HSL hsl;
+	
+	if (use_phase)
+	{
+		// Turn phase into a hue
+		hsl.H = (phase+PI)/(2*PI);
+		hsl.S = 1;
+		// Brightness is proportional to the transform magnitude
+		hsl.L = mag/2;
+		// Convert hue, saturation, and lum to RGB
+		toRGB(&hsl,rgb);
+	}
+	else
+	{
+		// Grayscale with brightness proportional to the transform magnitude
+		rgb->R = rgb->G = rgb->B = (float)mag;
+	}
+}
+
+// Fills the phase colour table with transform_color's colours at the centre of
+// each hue and magnitude step
+static void init_lut()
+{
+	int h, l;
+	struct RGB rgb;
+	
+	for (h=0; h<LUT_HUES; h++)
+	{
+		for (l=0; l<=LUT_LEVELS; l++)
+		{
+			transform_color(LUT_MAX*l/LUT_LEVELS, 2*PI*h/LUT_HUES-PI, 1, &rgb);
+			color_lut[h][l][0] = (int)(255*rgb.B+.5);
+			color_lut[h][l][1] = (int)(255*rgb.G+.5);
+			color_lut[h][l][2] = (int)(255*rgb.R+.5);
+		}
+	}
+}
+
+// Encodes n points of a normalized transform as BGR pixels in out, coloured like
+// transform_color (phase colours are quantized to LUT_HUES hues and LUT_LEVELS
+// magnitudes, and magnitudes are clamped to the brightest colour). phase is only
+// read if use_phase is set.
+void encode_pixels(double* mag, double* phase, int n, int use_phase, unsigned char* out)
+{
+	int i, h, l, v;
+	
+	if (use_phase)
+	{
+		pthread_once(&lut_once, init_lut);
+		for (i=0; i<n; i++)
+		{
+			h = (int)((phase[i]+PI)*(LUT_HUES/(2*PI))+.5);
+			if (h < 0 || h >= LUT_HUES) h = (h%LUT_HUES+LUT_HUES)%LUT_HUES;
+			l = (int)(mag[i]*(LUT_LEVELS/LUT_MAX)+.5);
+			if (l > LUT_LEVELS) l = LUT_LEVELS;
+			if (l < 0) l = 0;
+			memcpy(out+3*i, color_lut[h][l], 3);
+		}
+	}
+	else
+	{
+		for (i=0; i<n; i++)
+		{
+			v = (int)(255*mag[i]+.5);
+			if (v > 255) v = 255;
+			if (v < 0) v = 0;
+			out[3*i] = out[3*i+1] = out[3*i+2] = v;
+		}
+	}
+}
+
+// Thread encoding rows y0 to y1-1 of an image
+static void* encode_main(void* arg)
+{
+	encode_job* job = arg;
+	process_info* pi = job->pi;
+	int y, row = 3*pi->width+pi->width%4;
+	
+	for (y=job->y0; y<job->y1; y++)
+	{
+		encode_pixels(job->tform+y*pi->width, pi->phase ? job->tphase+y*pi->width : NULL,
+				pi->width, pi->phase, job->buf+(long long)y*row);
+	}
+	return NULL;
+}
+
+// Write transform to image. The pixels are encoded into one buffer, by up to
+// ENCODE_THREADS threads for large images, and written at once.
+// Returns 0 on success, -1 if the file could not be written
+int writeToImage(char* filename, process_info* pi, double* tform, double* tphase)
+{
+	FILE* gen_bmp;
+	int i, nthreads, row = 3*pi->width+pi->width%4, ret = 0;
+	long long size = (long long)row*pi->height;
+	unsigned char* buf;
+	pthread_t threads[ENCODE_THREADS];
+	int started[ENCODE_THREADS];
+	encode_job jobs[ENCODE_THREADS];
+	long long start = prof_start();
+	
+	// Open output bmp file
+	gen_bmp = fopen(filename,"w");
+	if (gen_bmp==NULL)
+	{
+		perror(filename); 
+		return -1;
+	}
+	// Row padding is left zero
+	buf = calloc(size, 1);
+	if (buf == NULL)
+	{
+		fclose(gen_bmp);
+		return -1;
+	}
+	
+	// Encode pixels: a band of rows per thread
+	nthreads = 1;
+	if ((long long)pi->width*pi->height >= ENCODE_MIN_PIXELS)
+	{
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads > ENCODE_THREADS) nthreads = ENCODE_THREADS;
+		if (nthreads > pi->height) nthreads = pi->height;
+		if (nthreads < 1) nthreads = 1;
+	}
+	for (i=0; i<nthreads; i++)
+	{
+		jobs[i] = (encode_job){ .pi = pi, .tform = tform, .tphase = tphase, .buf = buf,
+				.y0 = (long long)pi->height*i/nthreads,
+				.y1 = (long long)pi->height*(i+1)/nthreads };
+	}
+	for (i=1; i<nthreads; i++)
+	{
+		started[i] = pthread_create(&threads[i], NULL, encode_main, &jobs[i]) == 0;
+	}
+	encode_main(&jobs[0]);
+	for (i=1; i<nthreads; i++)
+	{
+		// Encode here any band a thread could not be started for
+		if (started[i]) pthread_join(threads[i], NULL);
+		else encode_main(&jobs[i]);
+	}
+	
+	// Write file header and pixels
+	write_bmp_header(gen_bmp, pi->height, pi->width);
+	if (fwrite(buf, 1, size, gen_bmp) != size)
+	{
+		perror(filename);
+		ret = -1;
+	}
+	fclose(gen_bmp);
+	free(buf);
+	prof_stop(PROF_IMAGE, start);
+	return ret;
+}
@@ -1,6 +1,15 @@
 #ifndef BMP_WRITE
 #define BMP_WRITE
 
+#include <stdio.h>
+#include "transform.h"
+
+#define LUT_HUES 256		// Hues of phase colours
+#define LUT_LEVELS 512		// Magnitudes of phase colours, evenly spaced up to LUT_MAX
+#define LUT_MAX 2.0			// Magnitude of white (transform_color's lightness is mag/2)
+#define ENCODE_THREADS 8	// Most threads encoding an image
+#define ENCODE_MIN_PIXELS (1<<18)	// Smallest image encoded by more than one thread
+
 // Red, green, blue color value (range: 0-1)
 struct RGB
 {
@@ -20,5 +29,8 @@ struct HSL
 void write_bmp_header(FILE* fp, int h, int w);
 void write_color(struct RGB* color, FILE* fp);
 void toRGB(struct HSL* in, struct RGB* out);
+void transform_color(double mag, double phase, int use_phase, struct RGB* rgb);
+void encode_pixels(double* mag, double* phase, int n, int use_phase, unsigned char* out);
+int writeToImage(char* filename, process_info* pi, double* tform, double* tphase);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "checkpoint.h"
+#include "rng.h"
+#include "prof.h"
+
+// Process writing the last background checkpoint (0: none)
+static pid_t ckpt_writer = 0;
+
+// Fills in the header of a checkpoint of pop_size songs after generation gen,
+// scored with ev
+static void make_header(ckpt_header* h, int pop_size, int gen, eval_info* ev)
+{
+	unsigned long long st[2];
+
+	memset(h, 0, sizeof(ckpt_header));
+	rng_get_state(st);
+	h->magic = CKPT_MAGIC;
+	h->version = CKPT_VERSION;
+	h->gen = gen;
+	h->pop_size = pop_size;
+	h->rng[0] = st[0];
+	h->rng[1] = st[1];
+	h->width = ev->pi->width;
+	h->height = ev->pi->height;
+	h->us = ev->pi->us;
+	h->datalen = ev->datalen;
+	h->st = ev->pi->st;
+	h->et = ev->pi->et;
+	h->b1 = ev->pi->b1;
+	h->tol = ev->pi->tol;
+	h->init = ev->init;
+}
+
+// Lays out a checkpoint in one buffer and sets len to its size. Returns NULL if
+// the buffer could not be allocated.
+static unsigned char* encode_checkpoint(song* pop, int pop_size, int gen, eval_info* ev,
+		size_t* len)
+{
+	int i, j, width = ev->pi->width;
+	size_t pos;
+	unsigned char* buf;
+	note n;
+	ckpt_song cs;
+
+	*len = sizeof(ckpt_header);
+	for (i=0; i<pop_size; i++)
+	{
+		*len += sizeof(ckpt_song)+pop[i].size*sizeof(note);
+		if (pop[i].colerr != NULL) *len += width*sizeof(double);
+	}
+	buf = malloc(*len);
+	if (buf == NULL) return NULL;
+
+	make_header((ckpt_header*)buf, pop_size, gen, ev);
+	pos = sizeof(ckpt_header);
+	for (i=0; i<pop_size; i++)
+	{
+		memset(&cs, 0, sizeof(cs));
+		cs.size = pop[i].size;
+		cs.parent1 = pop[i].parent1;
+		cs.parent2 = pop[i].parent2;
+		cs.ncols = (pop[i].colerr != NULL) ? width : 0;
+		cs.fitness = pop[i].fitness;
+		cs.err = pop[i].err;
+		cs.done = pop[i].done;
+		cs.screened = pop[i].screened;
+		memcpy(buf+pos, &cs, sizeof(cs));
+		pos += sizeof(cs);
+		for (j=0; j < pop[i].size; j++)
+		{
+			n = get_note(&pop[i], j);
+			memcpy(buf+pos, &n, sizeof(note));
+			pos += sizeof(note);
+		}
+		if (cs.ncols > 0)
+		{
+			memcpy(buf+pos, pop[i].colerr, width*sizeof(double));
+			pos += width*sizeof(double);
+		}
+	}
+	return buf;
+}
+
+// Writes len bytes of buf to filename under the temporary name tmpname, syncs it
+// and renames it into place, so a crash never leaves a partial checkpoint
+// behind. Only makes async-signal-safe calls, so it can run in a child forked
+// from a process with other threads. Returns 0 on success, -1 (with errno set)
+// on failure.
+static int write_checkpoint(char* filename, char* tmpname, unsigned char* buf, size_t len)
+{
+	int fd, ok, e;
+	ssize_t n;
+	size_t pos = 0;
+
+	fd = open(tmpname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	while (pos < len)
+	{
+		n = write(fd, buf+pos, len-pos);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		pos += n;
+	}
+	// Make sure the data is on disk before the rename makes it the checkpoint
+	ok = (pos == len) && (fsync(fd) == 0);
+	if (close(fd) != 0) ok = 0;
+	if (ok && rename(tmpname, filename) != 0) ok = 0;
+	if (!ok)
+	{
+		e = errno;
+		unlink(tmpname);
+		errno = e;
+	}
+	return ok ? 0 : -1;
+}
+
+// Writes a population scored with ev to a checkpoint file. Returns 0 on
+// success, -1 on failure.
+int save_checkpoint(char* filename, song* pop, int pop_size, int gen, eval_info* ev)
+{
+	int ret = -1;
+	size_t len;
+	unsigned char* buf = encode_checkpoint(pop, pop_size, gen, ev, &len);
+	char* tmpname = malloc(strlen(filename)+5);
+
+	sprintf(tmpname, "%s.tmp", filename);
+	if (buf != NULL) ret = write_checkpoint(filename, tmpname, buf, len);
+	if (ret < 0) perror(filename);
+	free(buf);
+	free(tmpname);
+	return ret;
+}
+
+// Writes a checkpoint from a forked process so the caller can continue
+// evolving while it is written to disk. The checkpoint is laid out in memory
+// before the fork, and the child only writes it out, since another thread
+// (such as the output writer) may hold a lock that the child would never see
+// released. Waits for the previous background checkpoint first. Returns 0 if
+// the writer was started, -1 otherwise.
+int save_checkpoint_bg(char* filename, song* pop, int pop_size, int gen, eval_info* ev)
+{
+	pid_t pid;
+	size_t len;
+	unsigned char* buf;
+	char* tmpname;
+	long long start = prof_start();
+
+	wait_checkpoint();
+	buf = encode_checkpoint(pop, pop_size, gen, ev, &len);
+	if (buf == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+	tmpname = malloc(strlen(filename)+5);
+	sprintf(tmpname, "%s.tmp", filename);
+	fflush(stdout); // Buffered output must not be printed twice
+	pid = fork();
+	if (pid == 0)
+	{
+		_exit(write_checkpoint(filename, tmpname, buf, len) ? 1 : 0);
+	}
+	free(buf);
+	free(tmpname);
+	if (pid < 0)
+	{
+		perror("Error starting checkpoint writer");
+		return -1;
+	}
+	ckpt_writer = pid;
+	prof_stop(PROF_CHECKPOINT, start);
+	return 0;
+}
+
+// Waits for the background checkpoint writer, if any, to finish
+void wait_checkpoint()
+{
+	int status;
+	if (ckpt_writer > 0)
+	{
+		if (waitpid(ckpt_writer, &status, 0) == ckpt_writer &&
+				(!WIFEXITED(status) || WEXITSTATUS(status)))
+		{
+			printf("Checkpoint writer failed.\n");
+		}
+		ckpt_writer = 0;
+	}
+}
+
+// Checks that a checkpoint header matches the population size and the goal and
+// transform settings of ev. Returns 0 if it does, -1 (after saying why) if not.
+static int check_header(ckpt_header* h, char* filename, int pop_size, eval_info* ev)
+{
+	if (h->pop_size == 0 || h->pop_size%4 != 0)
+	{
+		printf("Invalid checkpoint file %s.\n", filename);
+		return -1;
+	}
+	if ((int)h->pop_size != pop_size)
+	{
+		printf("Checkpoint %s holds %u songs: resume it with -n %u.\n", filename,
+				h->pop_size, h->pop_size);
+		return -1;
+	}
+	// The goal's energy may differ by rounding if it was transformed differently
+	if (h->width != (uint32_t)ev->pi->width || h->height != (uint32_t)ev->pi->height ||
+			h->us != (uint32_t)ev->pi->us || h->datalen != (uint32_t)ev->datalen ||
+			h->st != ev->pi->st || h->et != ev->pi->et || h->b1 != ev->pi->b1 ||
+			h->tol != ev->pi->tol || fabs(h->init-ev->init) > 1e-9*ev->init)
+	{
+		printf("Checkpoint %s was made from a different input or transform settings.\n",
+				filename);
+		return -1;
+	}
+	return 0;
+}
+
+// Loads a population of pop_size songs from a checkpoint file made with the same
+// goal and transform settings as ev, and restores the random number generator,
+// so evolution continues where it left off. Songs keep their column errors, so
+// their children are scored incrementally. Allocates *pop. Returns 0 on success,
+// -1 on failure.
+int load_checkpoint(char* filename, song** pop, int pop_size, int* gen, eval_info* ev)
+{
+	int fd, i;
+	struct stat sb;
+	unsigned char* data;
+	size_t pos, len;
+	ckpt_header* h;
+	ckpt_song* cs;
+	note* notes;
+	unsigned long long st[2];
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0)
+	{
+		perror(filename);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	if ((size_t)sb.st_size < sizeof(ckpt_header))
+	{
+		printf("Invalid checkpoint file %s.\n", filename);
+		close(fd);
+		return -1;
+	}
+	data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	h = (ckpt_header*)data;
+	if (h->magic != CKPT_MAGIC || h->version != CKPT_VERSION)
+	{
+		printf("Invalid checkpoint file %s.\n", filename);
+		munmap(data, sb.st_size);
+		return -1;
+	}
+	if (check_header(h, filename, pop_size, ev) < 0)
+	{
+		munmap(data, sb.st_size);
+		return -1;
+	}
+
+	*pop = malloc(h->pop_size*sizeof(song));
+	pos = sizeof(ckpt_header);
+	for (i=0; i < (int)h->pop_size; i++)
+	{
+		cs = (ckpt_song*)(data+pos);
+		pos += sizeof(ckpt_song);
+		len = (pos > (size_t)sb.st_size) ? 0 :
+				(size_t)cs->size*sizeof(note)+(size_t)cs->ncols*sizeof(double);
+		if (pos > (size_t)sb.st_size || pos+len > (size_t)sb.st_size ||
+				(cs->ncols != 0 && cs->ncols != h->width))
+		{
+			printf("Checkpoint file %s is truncated.\n", filename);
+			while (--i >= 0) dest_song(&(*pop)[i]);
+			free(*pop);
+			munmap(data, sb.st_size);
+			return -1;
+		}
+		notes = (note*)(data+pos);
+		pos += cs->size*sizeof(note);
+
+		init_song(&(*pop)[i]);
+		add_notes(notes, cs->size, &(*pop)[i]);
+		(*pop)[i].parent1 = cs->parent1;
+		(*pop)[i].parent2 = cs->parent2;
+		(*pop)[i].fitness = cs->fitness;
+		(*pop)[i].err = cs->err;
+		(*pop)[i].done = cs->done;
+		(*pop)[i].screened = cs->screened;
+		if (cs->ncols > 0)
+		{
+			(*pop)[i].colerr = malloc(cs->ncols*sizeof(double));
+			memcpy((*pop)[i].colerr, data+pos, cs->ncols*sizeof(double));
+			pos += cs->ncols*sizeof(double);
+		}
+	}
+
+	*gen = h->gen;
+	st[0] = h->rng[0];
+	st[1] = h->rng[1];
+	rng_set_state(st);
+	munmap(data, sb.st_size);
+	return 0;
+}
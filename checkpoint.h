@@ -0,0 +1,52 @@
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include <stdint.h>
+#include "song.h"
+#include "eval.h"
+
+#define CKPT_MAGIC 0x4B435441	// "ATCK" in little endian
+#define CKPT_VERSION 3
+
+// Start of a checkpoint file (all values in native byte order). The transform
+// settings, input length and goal energy identify the goal the population was
+// scored against, so it is only resumed against the same one.
+typedef struct ckpt_header
+{
+	uint32_t magic;		// CKPT_MAGIC
+	uint32_t version;	// CKPT_VERSION
+	uint32_t gen;		// Number of generations completed
+	uint32_t pop_size;	// Number of songs that follow
+	uint64_t rng[2];	// Random number generator state
+	uint32_t width;		// Transform settings (see process_info)
+	uint32_t height;
+	uint32_t us;
+	uint32_t datalen;	// Length of the input in samples
+	double st;
+	double et;
+	double b1;
+	double tol;
+	double init;		// Error of silence: the energy of the goal transform
+} ckpt_header;
+
+// Start of each song in a checkpoint file: followed by size notes, then ncols
+// column errors (see song)
+typedef struct ckpt_song
+{
+	uint32_t size;		// Number of notes
+	int32_t parent1;	// Parent numbers
+	int32_t parent2;
+	uint32_t ncols;		// Number of column errors (0 or the transform width)
+	uint32_t screened;	// Coarse level the error was estimated on (see song)
+	uint32_t reserved;	// Keeps the doubles aligned
+	double fitness;		// Fitness, error and scored fraction (see song)
+	double err;
+	double done;
+} ckpt_song;
+
+int save_checkpoint(char* filename, song* pop, int pop_size, int gen, eval_info* ev);
+int save_checkpoint_bg(char* filename, song* pop, int pop_size, int gen, eval_info* ev);
+void wait_checkpoint();
+int load_checkpoint(char* filename, song** pop, int pop_size, int* gen, eval_info* ev);
+
+#endif
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include "daemon.h"
+
+// State shared by the daemon's threads
+typedef struct daemon_info
+{
+	at_bank* bank;				// Piano notes and wavelets kept for every job
+	int queue[DAEMON_QUEUE];	// Connections waiting for a worker
+	int head;					// Index of the oldest waiting connection
+	int len;					// Number of waiting connections
+	int stop;					// Set when workers should finish the queue and exit
+	long jobs;					// Jobs started
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+} daemon_info;
+
+static volatile sig_atomic_t stopping = 0;
+
+// Stops the daemon on SIGINT or SIGTERM
+static void on_signal(int sig)
+{
+	stopping = 1;
+}
+
+// Seconds on a monotonic clock
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+// Sends a job to a connection
+static void write_job(int fd, job_info* job)
+{
+	at_options* o = &job->opt;
+	dprintf(fd, "in %s\nimage %s\nsong %s\nphase %d\n", job->in, job->image,
+			job->song, job->phase);
+	dprintf(fd, "w %d\nh %d\nst %.17g\net %.17g\nb %.17g\nus %d\ntol %.17g\n", o->width,
+			o->height, o->st, o->et, o->b1, o->us, o->tol);
+	dprintf(fd, "g %d\nn %d\nnotes %d\nsel %d\nt %d\nseed %d\n", o->gens,
+			o->pop_size, o->est_notes, o->sel_type, o->tour_size, o->seed);
+	dprintf(fd, "ls %d\nlsk %d\nmf %d\nmfk %.17g\ne %d\noff %.17g\n", o->ls_int,
+			o->ls_top, o->mf_levels, o->mf_keep, o->elite, o->offspring);
+	dprintf(fd, "q %d\nbpm %.17g\nsub %d\nqj %.17g\nrng %llu\n\n", o->quant, o->bpm,
+			o->sub, o->jitter, o->rng_seed);
+}
+
+// Reads a job sent by write_job. Settings that are not sent keep their
+// defaults. Returns 0 on success, -1 if the request is invalid.
+static int read_job(FILE* fp, job_info* job)
+{
+	int i;
+	char line[DAEMON_LINE+16];
+	char *key, *val, *end;
+	at_options* o = &job->opt;
+
+	memset(job, 0, sizeof(job_info));
+	at_default_options(o);
+	for (i=0; i<DAEMON_LINES; i++)
+	{
+		if (fgets(line, sizeof(line), fp) == NULL) return -1;
+		end = strchr(line, '\n');
+		if (end == NULL) return -1; // Too long, or cut off
+		*end = 0;
+		if (line[0] == 0) return (job->in[0] && job->image[0]) ? 0 : -1;
+
+		// The value is the rest of the line after the key and a space
+		key = line;
+		val = strchr(line, ' ');
+		if (val == NULL) return -1;
+		*val++ = 0;
+		if (strlen(val) >= DAEMON_LINE) return -1;
+		if (strcmp(key, "in") == 0) strcpy(job->in, val);
+		else if (strcmp(key, "image") == 0) strcpy(job->image, val);
+		else if (strcmp(key, "song") == 0) strcpy(job->song, val);
+		else if (strcmp(key, "phase") == 0) job->phase = atoi(val);
+		else if (strcmp(key, "w") == 0) o->width = atoi(val);
+		else if (strcmp(key, "h") == 0) o->height = atoi(val);
+		else if (strcmp(key, "st") == 0) o->st = atof(val);
+		else if (strcmp(key, "et") == 0) o->et = atof(val);
+		else if (strcmp(key, "b") == 0) o->b1 = atof(val);
+		else if (strcmp(key, "us") == 0) o->us = atoi(val);
+		else if (strcmp(key, "tol") == 0) o->tol = atof(val);
+		else if (strcmp(key, "g") == 0) o->gens = atoi(val);
+		else if (strcmp(key, "n") == 0) o->pop_size = atoi(val);
+		else if (strcmp(key, "notes") == 0) o->est_notes = atoi(val);
+		else if (strcmp(key, "sel") == 0) o->sel_type = atoi(val);
+		else if (strcmp(key, "t") == 0) o->tour_size = atoi(val);
+		else if (strcmp(key, "seed") == 0) o->seed = atoi(val);
+		else if (strcmp(key, "ls") == 0) o->ls_int = atoi(val);
+		else if (strcmp(key, "lsk") == 0) o->ls_top = atoi(val);
+		else if (strcmp(key, "mf") == 0) o->mf_levels = atoi(val);
+		else if (strcmp(key, "mfk") == 0) o->mf_keep = atof(val);
+		else if (strcmp(key, "e") == 0) o->elite = atoi(val);
+		else if (strcmp(key, "off") == 0) o->offspring = atof(val);
+		else if (strcmp(key, "q") == 0) o->quant = atoi(val);
+		else if (strcmp(key, "bpm") == 0) o->bpm = atof(val);
+		else if (strcmp(key, "sub") == 0) o->sub = atoi(val);
+		else if (strcmp(key, "qj") == 0) o->jitter = atof(val);
+		else if (strcmp(key, "rng") == 0) o->rng_seed = strtoull(val, NULL, 10);
+		else return -1;
+	}
+	return -1;
+}
+
+// Runs a job, writing its result line (without a newline) into reply
+static void run_job(at_bank* bank, job_info* job, char* reply, int len)
+{
+	int err;
+	double start = now();
+	at_ctx* ctx;
+	song best;
+
+	ctx = at_new(bank, &job->opt, &err);
+	if (ctx != NULL)
+	{
+		err = at_read_input(ctx, job->in);
+		if (err == 0) err = at_write_transform(ctx, job->image, job->phase);
+	}
+	if (err == 0 && job->song[0] && job->opt.gens > 0)
+	{
+		err = at_transcribe(ctx, &best);
+		if (err == 0)
+		{
+			write_song(&best, job->song);
+			snprintf(reply, len, "ok best error %g, written to %s in %.3f s",
+					best.err, job->song, now()-start);
+			dest_song(&best);
+		}
+	}
+	else if (err == 0)
+	{
+		snprintf(reply, len, "ok transform written to %s in %.3f s", job->image,
+				now()-start);
+	}
+	if (err < 0) snprintf(reply, len, "error %s: %s", job->in, at_strerror(err));
+	at_free(ctx);
+}
+
+// Reads a job from a connection, runs it and answers, then closes the connection
+static void serve(daemon_info* d, int fd)
+{
+	char reply[DAEMON_LINE+256];
+	long id;
+	FILE* fp;
+	job_info* job = malloc(sizeof(job_info));
+	struct timeval tv = { .tv_sec = DAEMON_TIMEOUT, .tv_usec = 0 };
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	fp = fdopen(fd, "r");
+	if (job == NULL || fp == NULL)
+	{
+		dprintf(fd, "error out of memory\n");
+		if (fp != NULL) fclose(fp);
+		else close(fd);
+		free(job);
+		return;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	id = ++d->jobs;
+	pthread_mutex_unlock(&d->lock);
+	if (read_job(fp, job) < 0)
+	{
+		snprintf(reply, sizeof(reply), "error invalid request");
+	}
+	else run_job(d->bank, job, reply, sizeof(reply));
+	printf("Job %ld: %s\n", id, reply);
+	fflush(stdout);
+	dprintf(fd, "%s\n", reply);
+	fclose(fp);
+	free(job);
+}
+
+// Worker thread: serves queued connections until told to stop and the queue is empty
+static void* worker_main(void* arg)
+{
+	daemon_info* d = arg;
+	int fd;
+
+	pthread_mutex_lock(&d->lock);
+	for (;;)
+	{
+		while (d->len == 0 && !d->stop)
+		{
+			pthread_cond_wait(&d->ready, &d->lock);
+		}
+		if (d->len == 0) break; // Stopped and nothing left to serve
+		fd = d->queue[d->head];
+		d->head = (d->head+1)%DAEMON_QUEUE;
+		d->len--;
+		pthread_mutex_unlock(&d->lock);
+
+		serve(d, fd);
+		pthread_mutex_lock(&d->lock);
+	}
+	pthread_mutex_unlock(&d->lock);
+	return NULL;
+}
+
+// Fills in the address of the socket file path. Returns -1 if it is too long.
+static int socket_addr(char* path, struct sockaddr_un* addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		printf("Socket path %s is too long.\n", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+// Loads the piano notes from notes_dir and serves jobs on the Unix socket path
+// with workers threads until interrupted, keeping the notes and the wavelets
+// of every job for the next. Returns 0 once stopped, -1 if it could not start.
+int run_daemon(char* path, int workers, char* notes_dir)
+{
+	int i, fd, lfd, err;
+	daemon_info d;
+	pthread_t* threads;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	mode_t mask;
+
+	if (workers < 1) workers = 1;
+	if (socket_addr(path, &addr) < 0) return -1;
+	puts("Loading piano notes...");
+	d.bank = at_load_bank(notes_dir, &err);
+	if (d.bank == NULL)
+	{
+		printf("Error loading piano notes: %s\n", at_strerror(err));
+		return -1;
+	}
+
+	// Jobs read and write any path the daemon can, so only its user may
+	// connect: the socket is made with mode 0600 (no threads run yet)
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path); // Left behind if a previous daemon was killed
+	mask = umask(0177);
+	err = (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0);
+	umask(mask);
+	if (err || listen(lfd, DAEMON_QUEUE) < 0)
+	{
+		perror(path);
+		if (lfd >= 0) close(lfd);
+		at_free_bank(d.bank);
+		return -1;
+	}
+
+	// Interrupt accept to stop, and keep going when a client hangs up early
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	d.head = 0;
+	d.len = 0;
+	d.stop = 0;
+	d.jobs = 0;
+	pthread_mutex_init(&d.lock, NULL);
+	pthread_cond_init(&d.ready, NULL);
+	threads = malloc(workers*sizeof(pthread_t));
+	for (i=0; i<workers; i++)
+	{
+		if (pthread_create(&threads[i], NULL, worker_main, &d) != 0) break;
+	}
+	workers = i;
+	printf("Serving on %s with %d workers.\n", path, workers);
+	fflush(stdout);
+
+	while (!stopping && workers > 0)
+	{
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+			continue;
+		}
+		pthread_mutex_lock(&d.lock);
+		if (d.len == DAEMON_QUEUE)
+		{
+			pthread_mutex_unlock(&d.lock);
+			dprintf(fd, "error busy\n");
+			close(fd);
+			continue;
+		}
+		d.queue[(d.head+d.len)%DAEMON_QUEUE] = fd;
+		d.len++;
+		pthread_cond_signal(&d.ready);
+		pthread_mutex_unlock(&d.lock);
+	}
+
+	// Finish the waiting jobs
+	close(lfd);
+	unlink(path);
+	pthread_mutex_lock(&d.lock);
+	d.stop = 1;
+	pthread_cond_broadcast(&d.ready);
+	pthread_mutex_unlock(&d.lock);
+	for (i=0; i<workers; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	printf("Stopped after %ld jobs.\n", d.jobs);
+
+	free(threads);
+	pthread_mutex_destroy(&d.lock);
+	pthread_cond_destroy(&d.ready);
+	at_free_bank(d.bank);
+	return 0;
+}
+
+// Sends a job to the daemon on the Unix socket path and waits for its answer,
+// which is copied into reply (len characters at most, without the newline).
+// Returns 0 if the job succeeded, -1 otherwise.
+int submit_job(char* path, job_info* job, char* reply, int len)
+{
+	int fd;
+	char* end;
+	FILE* fp;
+	struct sockaddr_un addr;
+
+	if (socket_addr(path, &addr) < 0) return -1;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		perror(path);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	write_job(fd, job);
+
+	fp = fdopen(fd, "r");
+	if (fp == NULL || fgets(reply, len, fp) == NULL)
+	{
+		snprintf(reply, len, "error no answer from %s", path);
+		if (fp != NULL) fclose(fp);
+		else close(fd);
+		return -1;
+	}
+	fclose(fp);
+	end = strchr(reply, '\n');
+	if (end != NULL) *end = 0;
+	return (strncmp(reply, "ok", 2) == 0) ? 0 : -1;
+}
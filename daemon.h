@@ -0,0 +1,26 @@
+#ifndef DAEMON
+#define DAEMON
+
+#include "autotranscribe.h"
+
+#define DAEMON_QUEUE 64		// Connections waiting for a worker before more are refused
+#define DAEMON_LINE 4096	// Longest line of a request
+#define DAEMON_LINES 64		// Most lines in a request
+#define DAEMON_TIMEOUT 10	// Seconds a worker waits for a client to send its request
+
+// A job for the daemon. It is sent as lines of "key value" (see write_job)
+// ending with an empty line, and answered with one line starting "ok" or
+// "error".
+typedef struct job_info
+{
+	char in[DAEMON_LINE];		// Input wav file
+	char image[DAEMON_LINE];	// Bitmap the input's transform is written to
+	char song[DAEMON_LINE];		// Text file the transcription is written to ("": none)
+	int phase;					// Whether to colour the bitmap by phase
+	at_options opt;				// Transform and transcription settings
+} job_info;
+
+int run_daemon(char* path, int workers, char* notes_dir);
+int submit_job(char* path, job_info* job, char* reply, int len);
+
+#endif
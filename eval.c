@@ -0,0 +1,571 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "eval.h"
+#include "ga.h"
+#include "piano.h"
+#include "selection.h"
+#include "prof.h"
+
+// Orders notes by start time, then by the remaining fields
+static int cmp_note(const void* a, const void* b)
+{
+	const note* na = a;
+	const note* nb = b;
+	if (na->start != nb->start) return (na->start < nb->start) ? -1 : 1;
+	if (na->pitch != nb->pitch) return (na->pitch < nb->pitch) ? -1 : 1;
+	if (na->dur != nb->dur) return (na->dur < nb->dur) ? -1 : 1;
+	if (na->volume != nb->volume) return (na->volume < nb->volume) ? -1 : 1;
+	return 0;
+}
+
+// Adds the squared errors in columns x0 to x1-1 of the transform to colerr,
+// a row at a time so the points summed are contiguous
+static void col_errs(double* tform, double* goal, int width, int height, int x0,
+		int x1, double* colerr)
+{
+	int y;
+	for (y=0; y<height; y++)
+	{
+		add_sq_err(tform+y*width+x0, (goal != NULL) ? goal+y*width+x0 : NULL, x1-x0,
+				colerr+x0);
+	}
+}
+
+// Energy of each column of a goal transform: the error of a silent column
+static double* goal_energy(double* goal, int width, int height)
+{
+	double* e = calloc(width, sizeof(double));
+	col_errs(goal, NULL, width, height, 0, width, e);
+	return e;
+}
+
+// Finds the transform columns x0 to x1-1 whose value may change when note n is
+// added or removed: columns whose wavelets overlap the samples render_music
+// writes for n. Returns 0 if the note is silent (x0 and x1 are then unset).
+int note_cols(note* n, eval_info* ev, int* x0, int* x1)
+{
+	long long a, b, len;
+	int half;
+	double scale;
+	process_info* pi = ev->pi;
+
+	// Samples written by render_music (the note sound files start 1 second in)
+	len = (long long)n->dur+FS;
+	if (len > FS*10) len = FS*10;
+	a = (long long)n->start-FS;
+	b = a+len;
+	if (a < 0) a = 0;
+	if (b > ev->datalen) b = ev->datalen;
+	if (a >= b) return 0; // Note is silent
+
+	// Widen by the reach of a column, then convert samples to columns conservatively
+	half = col_reach(ev->kb, pi)+1;
+	scale = pi->width/((pi->et-pi->st)*ev->header->sample_rate);
+	*x0 = (int)floor((a-half-pi->st*ev->header->sample_rate)*scale)-1;
+	*x1 = (int)ceil((b+half-pi->st*ev->header->sample_rate)*scale)+2;
+	if (*x0 < 0) *x0 = 0;
+	if (*x1 > pi->width) *x1 = pi->width;
+	return *x0 < *x1;
+}
+
+// Flags the columns affected by note n (see note_cols)
+static void mark_note(note* n, eval_info* ev)
+{
+	int x, x0, x1;
+	if (!note_cols(n, ev, &x0, &x1)) return;
+	for (x=x0; x<x1; x++)
+	{
+		ev->mark[x] = 1;
+	}
+}
+
+// Flags the columns affected by every note that appears in only one of the
+// two songs. Returns the number of differing notes.
+static int mark_diff(song* c, song* p, eval_info* ev)
+{
+	int i, j, d, ndiff = 0;
+	note* cn = malloc((c->size+1)*sizeof(note));
+	note* pn = malloc((p->size+1)*sizeof(note));
+
+	// Sort copies of both note lists so matching notes line up
+	for (i=0; i < c->size; i++) cn[i] = get_note(c, i);
+	for (j=0; j < p->size; j++) pn[j] = get_note(p, j);
+	i = 0;
+	j = 0;
+	qsort(cn, c->size, sizeof(note), cmp_note);
+	qsort(pn, p->size, sizeof(note), cmp_note);
+
+	while (i < c->size || j < p->size)
+	{
+		if (i == c->size) d = 1;
+		else if (j == p->size) d = -1;
+		else d = cmp_note(&cn[i], &pn[j]);
+
+		if (d == 0) // Note is in both songs
+		{
+			i++;
+			j++;
+			continue;
+		}
+		if (ev != NULL) mark_note((d < 0) ? &cn[i] : &pn[j], ev);
+		if (d < 0) i++;
+		else j++;
+		ndiff++;
+	}
+
+	free(cn);
+	free(pn);
+	return ndiff;
+}
+
+// Renders a song, transforms it and scores it against the goal transform.
+// Columns that none of the song's notes reach are silent in its transform, so
+// their error is the goal's energy there (ev->goal_col) and they are not
+// transformed; they are counted first, so the bound can stop evaluation
+// sooner. The other columns are calculated a block at a time, and evaluation
+// stops as soon as the error exceeds ev->bound; s->done records how far it got.
+// A stopped song's error is then estimated as the error of silence plus the
+// song's excess over silence in the columns it reaches, extrapolated from the
+// ones scored, so that songs worse than silence can still be told apart.
+// The columns transformed are added to s->cost.
+static void full_eval(song* s, eval_info* ev)
+{
+	int i, x, x0, x1, xe, y, pts, width = ev->pi->width, height = ev->pi->height;
+	int block = EVAL_BLOCK, scored = 0, transformed = 0, silent;
+	double quiet = 0;	// Error of silence over the columns scored
+	int* signal;
+	note n;
+	
+	render_music(s, ev->notes, &signal, ev->header);
+	
+	free(s->colerr);
+	// Keep the error of each column so children can be scored incrementally
+	s->colerr = ev->inc ? calloc(width, sizeof(double)) : NULL;
+	s->err = 0;
+	s->done = 1;
+	
+	memset(ev->mark, 0, width);
+	for (i=0; i < s->size; i++)
+	{
+		n = get_note(s, i);
+		mark_note(&n, ev);
+	}
+	for (x=0; x<width; x++)
+	{
+		if (ev->mark[x]) continue;
+		if (ev->inc) s->colerr[x] = ev->goal_col[x];
+		s->err += ev->goal_col[x];
+		scored++;
+	}
+	silent = scored;
+	quiet = s->err;
+	
+	if (scored == 0 && width <= block && !ev->inc)
+	{
+		// Whole transform at once: the error kernel can stop part way through
+		wavelet_cols(ev->kb, ev->header, ev->datalen, ev->pi, signal, 0, width,
+				ev->tform, NULL);
+		s->err = error_fn_bound(ev->tform, ev->goal, ev->tsize, ev->bound, &pts);
+		s->done = ((double)pts)/ev->tsize;
+		scored = transformed = width;
+		// Points are summed row by row, so take silence's share as proportional
+		if (s->done < 1) s->err = ev->init+(s->err-ev->init*s->done)/s->done;
+	}
+	
+	for (x0=0; x0<width && scored<width; x0=x1)
+	{
+		x1 = (x0+block < width) ? x0+block : width;
+		
+		// Each run of columns the song reaches
+		for (x=x0; x<x1; x=xe)
+		{
+			if (!ev->mark[x])
+			{
+				xe = x+1;
+				continue;
+			}
+			for (xe=x+1; xe<x1 && ev->mark[xe]; xe++);
+			wavelet_cols(ev->kb, ev->header, ev->datalen, ev->pi, signal, x, xe,
+					ev->tform, NULL);
+			if (ev->inc)
+			{
+				col_errs(ev->tform, ev->goal, width, height, x, xe, s->colerr);
+				for (i=x; i<xe; i++)
+				{
+					s->err += s->colerr[i];
+				}
+			}
+			else
+			{
+				for (y=0; y<height; y++)
+				{
+					s->err += error_fn(ev->tform+y*width+x, ev->goal+y*width+x, xe-x);
+				}
+			}
+			for (i=x; i<xe; i++)
+			{
+				quiet += ev->goal_col[i];
+			}
+			scored += xe-x;
+			transformed += xe-x;
+		}
+		
+		if (s->err > ev->bound && scored < width)
+		{
+			s->done = ((double)scored)/width;
+			if (scored > silent)
+			{
+				s->err = ev->init+(s->err-quiet)*(width-silent)/(scored-silent);
+			}
+			break;
+		}
+	}
+	free(signal);
+	s->cost += transformed*ev->cost_scale/width;
+	
+	if (s->done < 1)
+	{
+		// Column errors are incomplete, so children cannot build on them
+		free(s->colerr);
+		s->colerr = NULL;
+	}
+}
+
+// Sets the fitness of a song evaluated on the full transform and remembers its
+// error if it is exact
+static void finish_eval(song* s, eval_info* ev, unsigned long long h)
+{
+	s->screened = 0;
+	if (s->done < 1)
+	{
+		// Stopped early: the song is worse than the bound, so it has lost
+		s->fitness = 0;
+		return;
+	}
+	s->fitness = err_fitness(s->err, ev->init);
+	if (ev->cache != NULL) cache_put(ev->cache, h, s->err);
+}
+
+// Looks up a song's error in the cache. Returns 1 and sets the song's error and
+// fitness on a hit; otherwise returns 0 and sets h to the song's hash.
+static int lookup(song* s, eval_info* ev, unsigned long long* h)
+{
+	if (ev->cache == NULL) return 0;
+	*h = hash_song(s);
+	if (cache_get(ev->cache, *h, &s->err))
+	{
+		s->fitness = err_fitness(s->err, ev->init);
+		s->done = 1;
+		s->screened = 0;
+		return 1;
+	}
+	return 0;
+}
+
+// Scores a song against the goal transform. Songs whose notes were already
+// scored reuse the cached error.
+void eval_song(song* s, eval_info* ev)
+{
+	unsigned long long h = 0;
+	
+	s->cost = 0;
+	if (lookup(s, ev, &h)) return;
+	full_eval(s, ev);
+	finish_eval(s, ev, h);
+}
+
+// Scores child c of parents p1 and p2 (see eval_child), given the hash h of
+// its notes for the cache
+static void score_child(song* c, song* p1, song* p2, eval_info* ev, unsigned long long h)
+{
+	int x, x0, width = ev->pi->width, nmark = 0;
+	int half = col_reach(ev->kb, ev->pi);
+	long long a, b, lo = -1, done = 0;
+	double err;
+	song* p;
+
+	if (!ev->inc)
+	{
+		full_eval(c, ev);
+		finish_eval(c, ev, h);
+		return;
+	}
+
+	// Use the parent with fewer differing notes as the starting point
+	p = p1;
+	if (p1->colerr == NULL ||
+			(p2->colerr != NULL && mark_diff(c, p2, NULL) < mark_diff(c, p1, NULL)))
+	{
+		p = p2;
+	}
+	if (p->colerr == NULL) // Neither parent's column errors are known
+	{
+		full_eval(c, ev);
+		finish_eval(c, ev, h);
+		return;
+	}
+
+	memset(ev->mark, 0, width);
+	mark_diff(c, p, ev);
+	for (x=0; x<width; x++)
+	{
+		nmark += ev->mark[x];
+	}
+
+	free(c->colerr);
+	c->colerr = malloc(width*sizeof(double));
+	memcpy(c->colerr, p->colerr, width*sizeof(double));
+	err = p->err;
+
+	// Recalculate each run of affected columns
+	for (x=0; x<width; x++)
+	{
+		if (!ev->mark[x]) continue;
+		x0 = x;
+		while (x < width && ev->mark[x]) x++;
+		
+		// Render only the samples these columns' wavelets read (skipping any
+		// already rendered for the previous run)
+		a = col_sample(ev->header, ev->pi, x0)-half;
+		b = col_sample(ev->header, ev->pi, x-1)+half+1;
+		if (a < done) a = done;
+		if (a < 0) a = 0;
+		if (b > ev->datalen) b = ev->datalen;
+		if (a < b)
+		{
+			render_window(c, ev->notes, ev->sig, ev->datalen, a, b);
+			if (lo < 0) lo = a;
+			done = b;
+		}
+		
+		wavelet_cols(ev->kb, ev->header, ev->datalen, ev->pi, ev->sig, x0, x,
+				ev->tform, NULL);
+		memset(c->colerr+x0, 0, (x-x0)*sizeof(double));
+		col_errs(ev->tform, ev->goal, width, ev->pi->height, x0, x, c->colerr);
+		for (; x0<x; x0++)
+		{
+			err += c->colerr[x0]-p->colerr[x0];
+		}
+	}
+	// Leave the scratch signal silent for the next child
+	if (lo >= 0) memset(ev->sig+lo, 0, (done-lo)*sizeof(int));
+
+	c->err = err;
+	c->done = 1;
+	c->cost += ((double)nmark)/width;
+	finish_eval(c, ev, h);
+}
+
+// Scores a child of parents p1 and p2. Only the transform columns affected by
+// the notes that differ from the closer parent are recalculated; the child's
+// error is that parent's error plus the change in those columns.
+void eval_child(song* c, song* p1, song* p2, eval_info* ev)
+{
+	unsigned long long h = 0;
+	c->cost = 0;
+	if (lookup(c, ev, &h)) return;
+	score_child(c, p1, p2, ev, h);
+}
+
+// Song index and error estimate used to rank songs between screening levels
+typedef struct screened
+{
+	double err;
+	int idx;
+	unsigned long long h;	// Hash of the song's notes for the cache
+} screened;
+
+// Orders screened songs by increasing error
+static int cmp_screened(const void* a, const void* b)
+{
+	double ea = ((const screened*)a)->err, eb = ((const screened*)b)->err;
+	if (ea < eb) return -1;
+	if (ea > eb) return 1;
+	return ((const screened*)a)->idx - ((const screened*)b)->idx;
+}
+
+// Scores every individual of a population. If ev has coarser evaluators
+// (ev->coarse), the songs are first scored on the coarsest transform, and only
+// the best fraction ev->keep of them are scored again on the next finer one,
+// and so on up to ev itself (successive halving). A song that is not promoted
+// keeps its coarse error, scaled by the ratio of the two levels' errors for
+// silence to estimate its full error, and records the level in screened. Every
+// song's cost adds up the transforms computed for it at each level. Songs that
+// reach ev are scored incrementally from their parents if parents (the previous
+// generation) is given.
+void eval_pop(song* pop, int pop_size, song* parents, eval_info* ev)
+{
+	int i, k, n = 0, level, nlev = 0;
+	eval_info* e;
+	song* s;
+	screened* cand;
+	long long start = prof_start();
+
+	if (ev->coarse == NULL)
+	{
+		for (i=0; i<pop_size; i++)
+		{
+			s = &pop[i];
+			if (parents != NULL) eval_child(s, &parents[s->parent1], &parents[s->parent2], ev);
+			else eval_song(s, ev);
+		}
+		prof_stop(PROF_EVAL, start);
+		return;
+	}
+
+	// Songs already in the cache need no screening
+	cand = malloc((pop_size+1)*sizeof(screened));
+	for (i=0; i<pop_size; i++)
+	{
+		pop[i].cost = 0;
+		cand[n].h = 0;
+		if (!lookup(&pop[i], ev, &cand[n].h)) cand[n++].idx = i;
+	}
+	for (e=ev->coarse; e != NULL; e=e->coarse)
+	{
+		nlev++;
+	}
+
+	// Screen from the coarsest level up while there is a choice to make
+	for (level=nlev; level>0 && n>1; level--)
+	{
+		e = ev;
+		for (k=0; k<level; k++)
+		{
+			e = e->coarse;
+		}
+		for (i=0; i<n; i++)
+		{
+			s = &pop[cand[i].idx];
+			full_eval(s, e);
+			s->err *= ev->init/e->init;
+			s->fitness = err_fitness(s->err, ev->init);
+			s->screened = level;
+			cand[i].err = s->err;
+		}
+		qsort(cand, n, sizeof(screened), cmp_screened);
+		n = (int)ceil(n*ev->keep);
+	}
+
+	for (i=0; i<n; i++)
+	{
+		s = &pop[cand[i].idx];
+		if (parents != NULL)
+		{
+			score_child(s, &parents[s->parent1], &parents[s->parent2], ev, cand[i].h);
+		}
+		else
+		{
+			full_eval(s, ev);
+			finish_eval(s, ev, cand[i].h);
+		}
+	}
+	free(cand);
+	prof_stop(PROF_EVAL, start);
+}
+
+// Sets up ev to score songs rendered with the piano bank notes against goal,
+// the input's transform under pi normalized to a maximum of 1. pi->norm must be
+// the maximum before normalizing, so that rendered songs are on the same scale
+// as the goal, and kb must hold the wavelets for pi. There is no cache and no
+// screening until they are added. Free with dest_eval.
+void init_eval(eval_info* ev, wav_info* header, int datalen, process_info* pi,
+		kernel_bank* kb, double* goal, int** notes)
+{
+	ev->header = header;
+	ev->datalen = datalen;
+	ev->notes = notes;
+	ev->pi = pi;
+	ev->kb = kb;
+	ev->goal = goal;
+	ev->tsize = pi->width*pi->height;
+	ev->init = initial_err(goal, ev->tsize);
+	ev->goal_col = goal_energy(goal, pi->width, pi->height);
+	// Songs worse than silence get no fitness, so there is no need to finish them
+	ev->bound = ev->init;
+	ev->tform = malloc(ev->tsize*sizeof(double));
+	ev->mark = malloc(pi->width);
+	ev->sig = calloc(datalen, sizeof(int));
+	ev->cache = NULL;
+	ev->inc = 1;
+	ev->coarse = NULL;
+	ev->keep = 1;
+	ev->cost_scale = 1;
+}
+
+// Frees the scratch buffers and coarser evaluators of an evaluator
+void dest_eval(eval_info* ev)
+{
+	free(ev->tform);
+	free(ev->mark);
+	free(ev->sig);
+	free(ev->goal_col);
+	dest_coarse(ev);
+}
+
+// Adds up to levels coarser evaluators below ev for successive halving (see
+// eval_pop), each with half the columns and rows of the one above, promoting
+// the fraction keep of the songs at each level. signal is the input, which is
+// transformed again at each resolution to give that level's goal.
+void init_coarse(eval_info* ev, int* signal, int levels, double keep)
+{
+	int k;
+	double max;
+	eval_info *e, *fine = ev;
+	process_info* pi;
+
+	ev->keep = keep;
+	for (k=0; k<levels && fine->pi->width >= 2 && fine->pi->height >= 2; k++)
+	{
+		e = malloc(sizeof(eval_info));
+		*e = *fine; // Shares the input header and scratch signal
+		pi = malloc(sizeof(process_info));
+		*pi = *fine->pi;
+		pi->width >>= 1;
+		pi->height >>= 1;
+		pi->norm = 0;
+		e->pi = pi;
+		e->kb = malloc(sizeof(kernel_bank));
+		init_kernels(e->kb, e->header, e->datalen, pi);
+
+		// Goal at this resolution, on the same scale as ev's goal
+		e->tsize = pi->width*pi->height;
+		e->goal = malloc(e->tsize*sizeof(double));
+		max = wavelet_cols(e->kb, e->header, e->datalen, pi, signal, 0, pi->width,
+				e->goal, NULL);
+		normalize_transform(e->goal, e->tsize, max);
+		pi->norm = max;
+
+		e->init = initial_err(e->goal, e->tsize);
+		e->goal_col = goal_energy(e->goal, pi->width, pi->height);
+		e->bound = e->init;
+		e->tform = malloc(e->tsize*sizeof(double));
+		e->mark = malloc(pi->width);
+		e->cache = NULL; // Cached errors are full errors
+		e->inc = 0;
+		e->coarse = NULL;
+		e->cost_scale = ((double)e->tsize)/ev->tsize;
+		fine->coarse = e;
+		fine = e;
+	}
+}
+
+// Frees the coarser evaluators added by init_coarse
+void dest_coarse(eval_info* ev)
+{
+	eval_info *e, *next;
+	for (e=ev->coarse; e != NULL; e=next)
+	{
+		next = e->coarse;
+		dest_kernels(e->kb);
+		free(e->kb);
+		free(e->pi);
+		free(e->goal);
+		free(e->goal_col);
+		free(e->tform);
+		free(e->mark);
+		free(e);
+	}
+	ev->coarse = NULL;
+}
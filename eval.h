@@ -0,0 +1,44 @@
+#ifndef EVAL
+#define EVAL
+
+#include "song.h"
+#include "wav_rw.h"
+#include "transform.h"
+#include "fit_cache.h"
+
+#define EVAL_BLOCK 32	// Columns transformed between checks of the error bound
+
+// Everything needed to score an individual against the input
+typedef struct eval_info
+{
+	wav_info* header;	// Header of the input: sets the length of rendered songs
+	int datalen;		// Length of rendered songs in samples
+	int** notes;		// Piano bank songs are rendered with (see init_piano)
+	process_info* pi;	// Transform settings (pi->norm: maximum of the input's transform)
+	kernel_bank* kb;	// Wavelets for pi
+	double* goal;		// Transform of the input, normalized to a maximum of 1
+	double* goal_col;	// Energy of each column of the goal (see full_eval)
+	int tsize;			// Number of data points in the transform
+	double init;		// Error from silence (see initial_err)
+	double bound;		// Evaluation stops once a song's error exceeds this
+	double* tform;		// Scratch transform buffer for rendered songs
+	char* mark;			// Scratch flags for columns affected by changed notes
+	int* sig;			// Scratch signal of datalen samples, silent between uses
+	fit_cache* cache;	// Previously computed errors (NULL: always evaluate)
+	int inc;			// Whether to keep column errors for incremental evaluation
+	struct eval_info* coarse;	// Cheaper evaluator that screens songs first (NULL: none)
+	double keep;		// Fraction of screened songs promoted to the next finer level
+	double cost_scale;	// Size of this level's transform relative to the finest level's
+} eval_info;
+
+void init_eval(eval_info* ev, wav_info* header, int datalen, process_info* pi,
+		kernel_bank* kb, double* goal, int** notes);
+void dest_eval(eval_info* ev);
+void eval_song(song* s, eval_info* ev);
+void eval_child(song* c, song* p1, song* p2, eval_info* ev);
+void eval_pop(song* pop, int pop_size, song* parents, eval_info* ev);
+void init_coarse(eval_info* ev, int* signal, int levels, double keep);
+void dest_coarse(eval_info* ev);
+int note_cols(note* n, eval_info* ev, int* x0, int* x1);
+
+#endif
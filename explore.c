@@ -0,0 +1,355 @@
+// Measures what faster transform settings cost in accuracy. The reference
+// transform of an input is calculated once, then each setting is timed and
+// compared against it, and the results are printed as JSON.
+// Usage: at_explore [-i in.wav] [-w width] [-h height] [-b b1] [-o results.json]
+//        [setting ...]
+// A setting changes the reference settings, e.g. "b1=8,us=1" (see parse_setting).
+// Without -i the input is a synthetic passage.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "wav_rw.h"
+#include "song.h"
+#include "piano.h"
+#include "ga.h"
+#include "eval.h"
+#include "transform.h"
+#include "rng.h"
+#include "synth.h"
+
+#define EXPLORE_LEN (FS*3)		// Length of the synthetic input in samples
+#define EXPLORE_NOTES 60		// Notes in the synthetic input and in random songs
+#define EXPLORE_SONGS 12		// Songs ranked by each setting
+#define EXPLORE_MIN_TIME 0.5	// Seconds each transform is repeated for
+#define EXPLORE_MAX_SETTINGS 32
+
+// Everything a setting is compared on
+typedef struct explore_info
+{
+	wav_info header;
+	int* signal;			// Input
+	int datalen;
+	int** notes;			// Piano bank songs are rendered with
+	song cands[EXPLORE_SONGS];	// Songs ranked by each setting
+	double* ref;			// Reference transform, normalized to a maximum of 1
+	double* ref_phase;
+	double ref_err[EXPLORE_SONGS];	// Errors of the songs under the reference settings
+	double* tform;			// Scratch transforms
+	double* tphase;
+	double* goal;
+} explore_info;
+
+// Results for one setting
+typedef struct explore_result
+{
+	double secs;		// Fastest transform of the input
+	double max_err;		// Largest difference in normalized magnitude
+	double rms_err;		// Root mean square difference in normalized magnitude
+	double phase_err;	// Mean phase difference in radians, weighted by magnitude
+	double rank_corr;	// Spearman correlation of the songs' errors with the reference's
+	int same_best;		// Whether the reference's best song is also best here
+} explore_result;
+
+// Seconds on a monotonic clock
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+// Applies a comma separated list of key=value changes to pi. Keys are b1, us and
+// tol.
+// Returns -1 if the setting is invalid.
+static int parse_setting(char* setting, process_info* pi)
+{
+	char buf[256], *tok, *val;
+
+	if (strlen(setting) >= sizeof(buf)) return -1;
+	strcpy(buf, setting);
+	for (tok=strtok(buf, ","); tok != NULL; tok=strtok(NULL, ","))
+	{
+		val = strchr(tok, '=');
+		if (val == NULL) return -1;
+		*val++ = '\0';
+		if (strcmp(tok, "b1") == 0 && atof(val) > 0) pi->b1 = atof(val);
+		else if (strcmp(tok, "us") == 0) pi->us = atoi(val);
+		else if (strcmp(tok, "tol") == 0 && atof(val) > 0) pi->tol = atof(val);
+		else return -1;
+	}
+	return 0;
+}
+
+// Ranks of the values (0 for the smallest)
+static void ranks(double* v, int n, double* r)
+{
+	int i, j;
+
+	for (i=0; i<n; i++)
+	{
+		r[i] = 0;
+		for (j=0; j<n; j++)
+		{
+			if (v[j] < v[i] || (v[j] == v[i] && j < i)) r[i]++;
+		}
+	}
+}
+
+// Spearman rank correlation of a and b
+static double rank_corr(double* a, double* b, int n)
+{
+	int i;
+	double ra[EXPLORE_SONGS], rb[EXPLORE_SONGS], d2 = 0;
+
+	ranks(a, n, ra);
+	ranks(b, n, rb);
+	for (i=0; i<n; i++)
+	{
+		d2 += (ra[i]-rb[i])*(ra[i]-rb[i]);
+	}
+	return 1-6*d2/((double)n*(n*(double)n-1));
+}
+
+// Index of the smallest value
+static int min_index(double* v, int n)
+{
+	int i, m = 0;
+
+	for (i=1; i<n; i++)
+	{
+		if (v[i] < v[m]) m = i;
+	}
+	return m;
+}
+
+// Times the transform of the input under pi, repeating it for EXPLORE_MIN_TIME.
+// Returns the fastest run in seconds.
+static double time_trans(explore_info* ex, process_info* pi)
+{
+	double t, start, total = 0, best = -1;
+	int reps = 0;
+
+	while (total < EXPLORE_MIN_TIME || reps == 0)
+	{
+		start = now();
+		wavelet_trans(&ex->header, ex->datalen, pi, ex->signal, ex->tform, NULL);
+		t = now()-start;
+		total += t;
+		if (best < 0 || t < best) best = t;
+		reps++;
+	}
+	return best;
+}
+
+// Scores the candidate songs against the input under pi, as the GA would, and
+// sets err to their errors
+static void rank_songs(explore_info* ex, process_info* pi, double* err)
+{
+	int i;
+	process_info epi = *pi;
+	kernel_bank kb;
+	eval_info ev;
+
+	epi.norm = 0;
+	epi.norm = wavelet_trans(&ex->header, ex->datalen, &epi, ex->signal, ex->goal, NULL);
+	init_kernels(&kb, &ex->header, ex->datalen, &epi);
+	init_eval(&ev, &ex->header, ex->datalen, &epi, &kb, ex->goal, ex->notes);
+	ev.bound = HUGE_VAL; // Score every song completely
+	for (i=0; i<EXPLORE_SONGS; i++)
+	{
+		eval_song(&ex->cands[i], &ev);
+		err[i] = ex->cands[i].err;
+	}
+	dest_eval(&ev);
+	dest_kernels(&kb);
+}
+
+// Compares the transform under pi with the reference
+static void explore(explore_info* ex, process_info* pi, explore_result* res)
+{
+	int i, tsize = pi->width*pi->height;
+	double d, sq = 0, wsum = 0, psum = 0, err[EXPLORE_SONGS];
+
+	pi->norm = 0;
+	res->secs = time_trans(ex, pi);
+	wavelet_trans(&ex->header, ex->datalen, pi, ex->signal, ex->tform, ex->tphase);
+	res->max_err = 0;
+	for (i=0; i<tsize; i++)
+	{
+		d = fabs(ex->tform[i]-ex->ref[i]);
+		if (d > res->max_err) res->max_err = d;
+		sq += d*d;
+		// Phase is meaningless where there is no magnitude, so weight by it
+		d = fabs(remainder(ex->tphase[i]-ex->ref_phase[i], 2*PI));
+		psum += ex->ref[i]*d;
+		wsum += ex->ref[i];
+	}
+	res->rms_err = sqrt(sq/tsize);
+	res->phase_err = (wsum > 0) ? psum/wsum : 0;
+
+	rank_songs(ex, pi, err);
+	res->rank_corr = rank_corr(ex->ref_err, err, EXPLORE_SONGS);
+	res->same_best = min_index(ex->ref_err, EXPLORE_SONGS) == min_index(err, EXPLORE_SONGS);
+}
+
+// Makes the candidate songs. With a known transcription, song k has each note
+// mutated with probability k/EXPLORE_SONGS, so the songs get steadily worse;
+// otherwise they are random.
+static void make_cands(explore_info* ex, song* truth)
+{
+	int i, k;
+	note n;
+
+	if (truth == NULL)
+	{
+		gen_pop(ex->cands, EXPLORE_SONGS, EXPLORE_NOTES, ex->datalen);
+		return;
+	}
+	for (k=0; k<EXPLORE_SONGS; k++)
+	{
+		copy_song(truth, &ex->cands[k]);
+		for (i=0; i < ex->cands[k].size; i++)
+		{
+			if (rng_next()%EXPLORE_SONGS >= k) continue;
+			n = get_note(&ex->cands[k], i);
+			mutate_note(&n, ex->datalen);
+			set_note(&ex->cands[k], i, n);
+		}
+		sort_song(&ex->cands[k]);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	char* defaults[] = { "us=1", "us=1,tol=0.005", "b1=8", "b1=8,us=1", "b1=4",
+		"b1=4,us=1" };
+	char* settings[EXPLORE_MAX_SETTINGS];
+	char* in = NULL;
+	int i, nsettings = 0, tsize;
+	double ref_secs = 1;
+	FILE *fp, *out = stdout;
+	process_info ref = { .height = W_KEYS, .width = 250, .st = 0, .et = 1e9,
+			.b1 = 16, .b2 = 1, .sqrtt = 0, .phase = 1, .us = 0, .norm = 0 };
+	process_info pi;
+	explore_info ex;
+	explore_result res;
+	song truth;
+
+	for (i=1; i<argc; i++)
+	{
+		if (argv[i][0] == '-' && i+1 >= argc)
+		{
+			printf("Value of %s not specified\n", argv[i]);
+			return 1;
+		}
+		if (strcmp(argv[i],"-i")==0) in = argv[++i];
+		else if (strcmp(argv[i],"-w")==0) ref.width = atoi(argv[++i]);
+		else if (strcmp(argv[i],"-h")==0) ref.height = atoi(argv[++i]);
+		else if (strcmp(argv[i],"-b")==0) ref.b1 = atof(argv[++i]);
+		else if (strcmp(argv[i],"-o")==0)
+		{
+			i++;
+			if ((out = fopen(argv[i], "w")) == NULL)
+			{
+				perror(argv[i]);
+				return 1;
+			}
+		}
+		else if (nsettings < EXPLORE_MAX_SETTINGS) settings[nsettings++] = argv[i];
+	}
+	if (ref.width <= 0 || ref.height <= 0 || ref.b1 <= 0)
+	{
+		printf("Usage: at_explore [-i in.wav] [-w width] [-h height] [-b b1]"
+				" [-o results.json] [setting ...]\n");
+		return 1;
+	}
+	if (nsettings == 0)
+	{
+		nsettings = sizeof(defaults)/sizeof(defaults[0]);
+		memcpy(settings, defaults, sizeof(defaults));
+	}
+	for (i=0; i<nsettings; i++)
+	{
+		pi = ref;
+		if (parse_setting(settings[i], &pi) < 0)
+		{
+			printf("Invalid setting %s\n", settings[i]);
+			return 1;
+		}
+	}
+
+	// The input and candidate songs are the same from run to run
+	rng_seed(1);
+	synth_piano(&ex.notes);
+	if (in != NULL)
+	{
+		if (open_wav_r(in, &fp) < 0 || check_wav_header(fp, &ex.header) < 0) return 1;
+		ex.datalen = get_data_len(&ex.header);
+		read_signal(fp, &ex.header, &ex.signal);
+		fclose(fp);
+		make_cands(&ex, NULL);
+	}
+	else
+	{
+		ex.datalen = EXPLORE_LEN;
+		synth_header(&ex.header, ex.datalen);
+		synth_passage(&truth, ex.datalen, EXPLORE_NOTES);
+		render_music(&truth, ex.notes, &ex.signal, &ex.header);
+		make_cands(&ex, &truth);
+		dest_song(&truth);
+	}
+	clamp_times(&ex.header, ex.datalen, &ref);
+
+	tsize = ref.width*ref.height;
+	ex.ref = malloc(tsize*sizeof(double));
+	ex.ref_phase = malloc(tsize*sizeof(double));
+	ex.tform = malloc(tsize*sizeof(double));
+	ex.tphase = malloc(tsize*sizeof(double));
+	ex.goal = malloc(tsize*sizeof(double));
+	wavelet_trans(&ex.header, ex.datalen, &ref, ex.signal, ex.ref, ex.ref_phase);
+	rank_songs(&ex, &ref, ex.ref_err);
+
+	fprintf(out, "{\n  \"input\": \"%s\", \"seconds\": %g, \"songs\": %d,\n",
+			(in != NULL) ? in : "passage", ref.et-ref.st, EXPLORE_SONGS);
+	fprintf(out, "  \"reference\": {\"width\": %d, \"height\": %d, \"b1\": %g, \"us\": %d},\n",
+			ref.width, ref.height, ref.b1, ref.us);
+	fprintf(out, "  \"settings\": [");
+	fprintf(stderr, "%-20s %10s %8s %10s %10s %10s %8s %5s\n", "setting", "seconds",
+			"speedup", "max err", "rms err", "phase err", "rank r", "best");
+	for (i=-1; i<nsettings; i++)
+	{
+		pi = ref;
+		if (i >= 0) parse_setting(settings[i], &pi);
+		explore(&ex, &pi, &res);
+		if (i < 0)
+		{
+			ref_secs = res.secs;
+			continue;
+		}
+		fprintf(out, "%s\n    {\"setting\": \"%s\", \"b1\": %g, \"us\": %d, \"tol\": %g, "
+				"\"seconds\": %.6g, \"speedup\": %.4g, \"max_err\": %.6g, \"rms_err\": %.6g, "
+				"\"phase_err\": %.6g, \"rank_corr\": %.6g, \"same_best\": %d}", (i > 0) ? "," : "", settings[i],
+				pi.b1, pi.us, pi.tol, res.secs, ref_secs/res.secs, res.max_err, res.rms_err,
+				res.phase_err, res.rank_corr, res.same_best);
+		fprintf(stderr, "%-20s %10.4g %8.3g %10.4g %10.4g %10.4g %8.4f %5s\n", settings[i],
+				res.secs, ref_secs/res.secs, res.max_err, res.rms_err, res.phase_err,
+				res.rank_corr, res.same_best ? "yes" : "no");
+	}
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout) fclose(out);
+
+	for (i=0; i<EXPLORE_SONGS; i++)
+	{
+		dest_song(&ex.cands[i]);
+	}
+	free(ex.signal);
+	free(ex.ref);
+	free(ex.ref_phase);
+	free(ex.tform);
+	free(ex.tphase);
+	free(ex.goal);
+	dest_piano(ex.notes);
+	return 0;
+}
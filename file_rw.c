@@ -27,14 +27,24 @@ void writeZeros(int num, FILE* fp)
 	}
 }
 
-// Gets four bytes and returns it as a 32 bit integer value (little endian)
+// Gets four bytes and returns it as a 32 bit integer value (little endian).
+// The bytes are read in separate statements since the order of calls within
+// one expression is unspecified.
 int get_int32(FILE* fp)
 {
-	return (fgetc(fp)|(fgetc(fp)<<8)|(fgetc(fp)<<16)|(fgetc(fp)<<24));
+	int b0, b1, b2, b3;
+	b0 = fgetc(fp);
+	b1 = fgetc(fp);
+	b2 = fgetc(fp);
+	b3 = fgetc(fp);
+	return (b0|(b1<<8)|(b2<<16)|((unsigned)b3<<24));
 }
 
 // Gets two bytes and returns it as a 16 bit integer value (little endian)
 int get_int16(FILE* fp)
 {
-	return (fgetc(fp)|(fgetc(fp)<<8));
+	int b0, b1;
+	b0 = fgetc(fp);
+	b1 = fgetc(fp);
+	return (b0|(b1<<8));
 }
\ No newline at end of file
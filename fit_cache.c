@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include "fit_cache.h"
+
+// Mixes the bits of a 64 bit value (splitmix64 finalizer)
+static unsigned long long mix64(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// Hashes every field of a note
+unsigned long long hash_note(note* n)
+{
+	return mix64(mix64(((unsigned long long)n->start<<32) | n->dur)
+			^ (((unsigned long long)n->pitch<<32) | n->volume));
+}
+
+// Hashes the notes of a song. Rendering does not depend on the order of the
+// notes array, so note hashes are summed: songs containing the same notes in
+// a different order share a hash.
+unsigned long long hash_song(song* s)
+{
+	int i;
+	unsigned long long h = 0;
+	note n;
+	for (i=0; i < s->size; i++)
+	{
+		n = get_note(s, i);
+		h += hash_note(&n);
+	}
+	h = mix64(h ^ mix64(s->size));
+	return h ? h : 1; // 0 marks an empty slot
+}
+
+// Sets up an empty cache with room for at least capacity entries
+void init_cache(fit_cache* c, int capacity)
+{
+	c->capacity = CACHE_WAYS;
+	while (c->capacity < capacity) c->capacity <<= 1;
+	c->keys = calloc(c->capacity, sizeof(unsigned long long));
+	c->err = malloc(c->capacity*sizeof(double));
+	c->hits = 0;
+	c->misses = 0;
+}
+
+// Looks up the error of a song by hash: returns 1 and sets err on a hit, 0 on a miss
+int cache_get(fit_cache* c, unsigned long long h, double* err)
+{
+	int i, idx;
+	for (i=0; i<CACHE_WAYS; i++)
+	{
+		idx = (h+i) & (c->capacity-1);
+		if (c->keys[idx] == h)
+		{
+			*err = c->err[idx];
+			c->hits++;
+			return 1;
+		}
+		if (c->keys[idx] == 0) break;
+	}
+	c->misses++;
+	return 0;
+}
+
+// Stores the error of a song. When all probed slots are taken, the first one
+// is replaced so the cache never grows beyond its capacity.
+void cache_put(fit_cache* c, unsigned long long h, double err)
+{
+	int i, idx, victim = h & (c->capacity-1);
+	for (i=0; i<CACHE_WAYS; i++)
+	{
+		idx = (h+i) & (c->capacity-1);
+		if (c->keys[idx] == h || c->keys[idx] == 0)
+		{
+			victim = idx;
+			break;
+		}
+	}
+	c->keys[victim] = h;
+	c->err[victim] = err;
+}
+
+// Frees the memory used by a cache
+void dest_cache(fit_cache* c)
+{
+	free(c->keys);
+	free(c->err);
+}
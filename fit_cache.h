@@ -0,0 +1,25 @@
+#ifndef FIT_CACHE
+#define FIT_CACHE
+
+#include "song.h"
+
+#define CACHE_WAYS 4	// Slots probed for each hash before evicting
+
+// Bounded table of error values of previously evaluated songs, keyed by genome hash
+typedef struct fit_cache
+{
+	unsigned long long* keys;	// Genome hash of each slot (0: empty)
+	double* err;				// Error value of each slot
+	int capacity;				// Number of slots (power of 2)
+	long hits;					// Lookups answered from the cache
+	long misses;				// Lookups that required a full evaluation
+} fit_cache;
+
+unsigned long long hash_note(note* n);
+unsigned long long hash_song(song* s);
+void init_cache(fit_cache* c, int capacity);
+int cache_get(fit_cache* c, unsigned long long h, double* err);
+void cache_put(fit_cache* c, unsigned long long h, double err);
+void dest_cache(fit_cache* c);
+
+#endif
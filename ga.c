@@ -1,56 +1,164 @@
 #include <stdlib.h>
+#include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "ga.h"
 #include "piano.h"
+#include "rng.h"
+#include "checkpoint.h"
+#include "refine.h"
+#include "seed.h"
+#include "prof.h"
 
 // Generates the population of songs
 void gen_pop(song* pop, int pop_size, int est_notes, int upper_lim)
 {
 	int i, j;
-	note n;
+	note* n = malloc((est_notes+1)*sizeof(note));
 	for (i=0; i<pop_size; i++)
 	{
 		init_song(&pop[i]); // Create song
 		// Add est_notes random notes to the song
 		for (j=0; j<est_notes; j++)
 		{
-			randomize_note(&n, upper_lim);
-			add_note(n,&pop[i]);
+			randomize_note(&n[j], upper_lim);
+		}
+		add_notes(n, est_notes, &pop[i]);
+	}
+	free(n);
+}
+
+// Generates the initial population: seeded from the notes found in the input
+// if there are any, random otherwise, and moved to the grid if there is one
+void init_pop(song* pop, ga_info* gi, int upper_lim)
+{
+	int i;
+	if (gi->nseeds > 0)
+	{
+		gen_pop_seeded(pop, gi->pop_size, gi->est_notes, upper_lim, gi->seeds, gi->nseeds);
+	}
+	else
+	{
+		gen_pop(pop, gi->pop_size, gi->est_notes, upper_lim);
+	}
+	for (i=0; i < gi->pop_size && gi->grid != NULL; i++)
+	{
+		snap_song(&pop[i], gi->grid, upper_lim);
+	}
+}
+
+// Evolves a single population until gi->gens generations have passed,
+// reporting progress after each if gi->verbose is set, and sets best to a
+// copy of the best song.
+// The population is checkpointed every gi->ckpt_int generations if gi->ckpt is
+// set, and resumed from gi->resume if that is set. Returns 0 on success, -1 if
+// the checkpoint could not be resumed.
+int evolve(ga_info* gi, int upper_lim, song* best)
+{
+	int i, j, b, stopped, screened, start = 0;
+	long evals = 0, reused = 0;
+	double work;
+	fit_cache* cache = gi->ev->cache;
+	song* pop;
+	
+	if (gi->resume != NULL)
+	{
+		// The checkpoint restores the population and the RNG state
+		if (load_checkpoint(gi->resume, &pop, gi->pop_size, &start, gi->ev) < 0) return -1;
+		printf("Resuming %s after generation %d.\n", gi->resume, start);
+	}
+	else
+	{
+		pop = malloc(gi->pop_size*sizeof(song));
+		init_pop(pop, gi, upper_lim);
+		eval_pop(pop, gi->pop_size, NULL, gi->ev);
+	}
+	
+	for (i=start; i < gi->gens; i++)
+	{
+		if (cache != NULL)
+		{
+			evals = cache->misses;
+			reused = cache->hits;
+		}
+		mutate_pop(&pop, gi->pop_size, upper_lim, gi);
+		
+		b = best_ind(pop, gi->pop_size);
+		stopped = screened = 0;
+		work = 0;
+		for (j=0; j < gi->pop_size; j++)
+		{
+			if (pop[j].done < 1) stopped++;
+			if (pop[j].screened) screened++;
+			work += pop[j].cost;
+		}
+		if (cache != NULL)
+		{
+			evals = cache->misses-evals;
+			reused = cache->hits-reused;
+		}
+		if (gi->verbose)
+		{
+			printf("Generation %d: best error %g, %ld evaluated, %ld reused, "
+					"%d stopped early, %d screened (%.0f%% of full scoring)\n",
+					i+1, pop[b].err, evals, reused, stopped, screened, 100*work/gi->pop_size);
+		}
+		if (gi->ls_int > 0 && (i+1)%gi->ls_int == 0)
+		{
+			j = refine_pop(pop, gi->pop_size, gi->ls_top, gi->ev);
+			if (gi->verbose) printf("Generation %d: refined the volumes of %d of the best %d songs, "
+					"best error %g\n", i+1, j, gi->ls_top,
+					pop[best_ind(pop, gi->pop_size)].err);
+		}
+		
+		if (gi->out != NULL) output_gen(gi->out, pop, gi->pop_size, i+1);
+		if (gi->ckpt != NULL && (i+1)%gi->ckpt_int == 0)
+		{
+			save_checkpoint_bg(gi->ckpt, pop, gi->pop_size, i+1, gi->ev);
 		}
 	}
+	wait_checkpoint();
+	
+	copy_song(&pop[best_ind(pop, gi->pop_size)], best);
+	for (j=0; j < gi->pop_size; j++)
+	{
+		dest_song(&pop[j]);
+	}
+	free(pop);
+	return 0;
 }
 
-// Mutates the population (upper_lim is the maximum sample number)
-void mutate_pop(song** pop, int pop_size, int upper_lim)
+// Mutates the population (upper_lim is the maximum sample number). Children
+// replace the whole population unless gi->offspring or gi->elite leave some of
+// it in place: then only enough children are made to replace the worst songs,
+// and the best songs carry over with their scores (see child_count).
+void mutate_pop(song** pop, int pop_size, int upper_lim, ga_info* gi)
 {
 	int i, j, k, sel, idx;
-	double fitsum = 0;
-	double rnd;
-	int selnum = pop_size/2; // Select half of the population to reproduce
+	int nchild = child_count(pop_size, gi);
+	int nkeep = pop_size-nchild; // Songs carried over from the current population
+	int selnum = ((nchild+3)&~3)/2; // Each pair of selections makes 4 children
 	song** selections = malloc(selnum*sizeof(song*)); // Keeps track of selections
 	int* parent = malloc(selnum*sizeof(int)); // Keeps track of parents for reference
-	song* newpop = malloc(pop_size*sizeof(song)); // New population
+	song* newpop = malloc((pop_size+3)*sizeof(song)); // New population
+	int* order = malloc(pop_size*sizeof(int));
 	note n;
 	song s1, s2, s3, s4;
+	selector st;
+	long long start = prof_start();
 	
-	// Sum all fitnesses for roulette wheel selection
-	for (i=0; i<pop_size; i++)
-	{
-		fitsum += (*pop)[i].fitness;
-	}
+	// Build the selection table once so each selection is cheap
+	init_selector(&st, *pop, pop_size, gi->sel_type, gi->tour_size);
+	// Rank the population by error if any of it carries over: fitness cannot
+	// tell apart the songs no better than silence
+	if (nkeep > 0) rank_err(*pop, pop_size, order);
 
 	for (i=0; i<selnum; i++)
 	{
-		// Choose random individual with roulette wheel selection
-		rnd = ((double)rand())/RAND_MAX*fitsum;
-		sel=0;
-		
-		// Reverse of the usual method: subtract individual fitnesses until 0 is reached
-		rnd -= (*pop)[sel].fitness;
-		while (rnd>0)
-		{
-			sel++;
-			rnd -= (*pop)[sel].fitness;
-		}
+		sel = select_ind(&st);
 		// Save selection and the individual number
 		selections[i] = &(*pop)[sel];
 		parent[i] = sel;
@@ -62,15 +170,15 @@ void mutate_pop(song** pop, int pop_size, int upper_lim)
 		// Create 4 new individuals by crossing over the note arrays of each twice
 		splice(selections[i],selections[i+1],&s1,&s2);
 		splice(selections[i],selections[i+1],&s3,&s4);
-		newpop[2*i] = s1;
-		newpop[2*i+1] = s2;
-		newpop[2*i+2] = s3;
-		newpop[2*i+3] = s4;
+		newpop[nkeep+2*i] = s1;
+		newpop[nkeep+2*i+1] = s2;
+		newpop[nkeep+2*i+2] = s3;
+		newpop[nkeep+2*i+3] = s4;
 		
 		// Mutate each child
 		for (j=0; j<4; j++)
 		{
-			idx = 2*i+j;
+			idx = nkeep+2*i+j;
 			
 			// Save parent numbers for each child
 			newpop[idx].parent1 = parent[i];
@@ -78,57 +186,144 @@ void mutate_pop(song** pop, int pop_size, int upper_lim)
 			// Mutate each note of the song
 			for (k=0; k < newpop[idx].size; k++)
 			{
-				mutate_note(&(newpop[idx].notes[k]), upper_lim);
+				n = get_note(&newpop[idx], k);
+				if (gi->grid != NULL) mutate_grid_note(&n, upper_lim, gi->grid);
+				else mutate_note(&n, upper_lim);
+				set_note(&newpop[idx], k, n);
 			}
+			// Mutated start times may be out of order
+			sort_song(&newpop[idx]);
 			
 			// Randomly add or remove note
-			if ((rand()%16) == 0)
+			if ((rng_next()%16) == 0)
 			{
 				randomize_note(&n, upper_lim);
+				if (gi->grid != NULL) snap_note(&n, gi->grid, upper_lim);
 				add_note(n, &newpop[idx]);
 			}
-			if ((rand()%16) == 0 && newpop[idx].size!=0)
+			if ((rng_next()%16) == 0 && newpop[idx].size!=0)
 			{
-				remove_note(&newpop[idx], rand()%newpop[idx].size);
+				remove_note(&newpop[idx], rng_next()%newpop[idx].size);
 			}
 		}
 	}
 	free(selections);
 	free(parent);
+	// Children past the size of the population (made in groups of 4) are not needed
+	for (i=pop_size; i < nkeep+2*selnum; i++)
+	{
+		dest_song(&newpop[i]);
+	}
+	
+	// Score the children, reusing their parents' column errors where possible.
+	// Every child takes part in the next selection, so each is scored against
+	// the evaluator's own bound (silence) rather than the songs carried over.
+	if (gi->ev != NULL) eval_pop(newpop+nkeep, nchild, *pop, gi->ev);
 	
-	// Free the memory of the old population
+	// Carry over the best songs (order is sorted from best to worst) and free
+	// the memory of the rest of the old population
 	for (i=0; i<pop_size; i++)
 	{
-		dest_song(&(*pop)[i]);
+		idx = (nkeep > 0) ? order[i] : i;
+		if (i < nkeep)
+		{
+			newpop[i] = (*pop)[idx];
+			newpop[i].cost = 0; // Not scored again this generation
+		}
+		else dest_song(&(*pop)[idx]);
 	}
+	dest_selector(&st);
+	free(order);
 	free(*pop);
 	*pop = newpop; // Set the population to the new population
+	prof_stop(PROF_GEN, start);
+}
+
+// Number of children made each generation: the fraction gi->offspring of the
+// population (all of it if that is not in (0,1)), but leaving at least the
+// gi->elite best songs in place
+int child_count(int pop_size, ga_info* gi)
+{
+	int nchild = pop_size;
+	if (gi->offspring > 0 && gi->offspring < 1) nchild = (int)ceil(gi->offspring*pop_size);
+	if (nchild > pop_size-gi->elite) nchild = pop_size-gi->elite;
+	if (nchild < 1) nchild = 1;
+	return nchild;
+}
+
+// Returns the index of the fittest individual. Songs scored in full on the full
+// transform come first, since the fitness of a song that was screened or stopped
+// early is an estimate. Ties (such as several songs no better than silence) go
+// to the song with the lowest error.
+int best_ind(song* pop, int pop_size)
+{
+	int i, best = 0;
+	for (i=1; i<pop_size; i++)
+	{
+		if (exact_score(&pop[i]) != exact_score(&pop[best]))
+		{
+			if (exact_score(&pop[i])) best = i;
+		}
+		else if (pop[i].fitness > pop[best].fitness ||
+				(pop[i].fitness == pop[best].fitness && pop[i].done >= pop[best].done
+				&& pop[i].err < pop[best].err))
+		{
+			best = i;
+		}
+	}
+	return best;
 }
 
 // Performs a crossover on two parent songs to generate two child songs
 void splice(song* in1, song* in2, song* out1, song* out2)
 {
-	int i, p;
+	int i, p, n;
+	note* buf = malloc((in1->size+in2->size+1)*sizeof(note));
 	// p: crossover point
-	p = rand()%((in1->size < in2->size)?(in1->size+1):(in2->size+1));
+	p = rng_next()%((in1->size < in2->size)?(in1->size+1):(in2->size+1));
 	// Initialize children
 	init_song(out1);
 	init_song(out2);
 	
-	// Copy notes from before the crossover point to the children
-	for (i=0; i<p; i++)
-	{
-		add_note(in1->notes[i], out1);
-		add_note(in2->notes[i], out2);
-	}
-	// Copy notes after the crossover point to the children
-	for (i=p; i < in2->size; i++)
-	{
-		add_note(in2->notes[i], out1);
-	}
-	for (i=p; i < in1->size; i++)
+	// Copy notes from before the crossover point to the children, followed by
+	// the notes after it (add_notes merges them back into start time order)
+	n = 0;
+	for (i=0; i<p; i++) buf[n++] = get_note(in1, i);
+	for (i=p; i < in2->size; i++) buf[n++] = get_note(in2, i);
+	add_notes(buf, n, out1);
+	n = 0;
+	for (i=0; i<p; i++) buf[n++] = get_note(in2, i);
+	for (i=p; i < in1->size; i++) buf[n++] = get_note(in1, i);
+	add_notes(buf, n, out2);
+	free(buf);
+}
+
+// Mutates the pitch of a note
+static void mutate_pitch(note* n)
+{
+	// The second, third, and fourth harmonics are 12, 19, and 24 keys away, respectively, so
+	// notes can randomly shift harmonics (since in the wavelet transform, notes may line up
+	// with harmonics instead of the other notes)
+	if (rng_next()%8 == 0 && (n->pitch < PIANO_KEYS-12)) n->pitch += 12;
+	if (rng_next()%8 == 0 && (n->pitch >= 12)) n->pitch -= 12;
+	if (rng_next()%16 == 0 && (n->pitch < PIANO_KEYS-19)) n->pitch += 19;
+	if (rng_next()%16 == 0 && (n->pitch >= 19)) n->pitch -= 19;
+	if (rng_next()%32 == 0 && (n->pitch < PIANO_KEYS-24)) n->pitch += 24;
+	if (rng_next()%32 == 0 && (n->pitch >= 24)) n->pitch -= 24;
+	if (rng_next()%16 == 0) n->pitch = rng_next()%PIANO_KEYS;
+}
+
+// Mutates the volume of a note
+static void mutate_volume(note* n)
+{
+	int i, mask;
+	for (i=0; i<8; i++)
 	{
-		add_note(in1->notes[i], out2);
+		mask = 1<<i;
+		if (rng_next()%(4<<(i)) == 0)
+		{
+			n->volume ^= mask;
+		}
 	}
 }
 
@@ -137,16 +332,7 @@ void mutate_note(note* n, int upper_lim)
 {
 	int i, mask, dev_start = 3, dev_dur = 2; // Start time can mutate more than duration
 	
-	// The second, third, and fourth harmonics are 12, 19, and 24 keys away, respectively, so
-	// notes can randomly shift harmonics (since in the wavelet transform, notes may line up
-	// with harmonics instead of the other notes)
-	if (rand()%8 == 0 && (n->pitch < PIANO_KEYS-12)) n->pitch += 12;
-	if (rand()%8 == 0 && (n->pitch >= 12)) n->pitch -= 12;
-	if (rand()%16 == 0 && (n->pitch < PIANO_KEYS-19)) n->pitch += 19;
-	if (rand()%16 == 0 && (n->pitch >= 19)) n->pitch -= 19;
-	if (rand()%32 == 0 && (n->pitch < PIANO_KEYS-24)) n->pitch += 24;
-	if (rand()%32 == 0 && (n->pitch >= 24)) n->pitch -= 24;
-	if (rand()%16 == 0) n->pitch = rand()%PIANO_KEYS;
+	mutate_pitch(n);
 	
 	// Mutate start time and duration
 	for (i=0; i<32; i++)
@@ -154,12 +340,12 @@ void mutate_note(note* n, int upper_lim)
 		// Chance to flip each bit of the start value
 		mask = 1<<i;
 		// Lower chance of flipping more significant bits
-		if (rand()%(4<<(i/dev_start)) == 0)
+		if (rng_next()%(4<<(i/dev_start)) == 0)
 		{
 			n->start ^= mask;
 		}
 		
-		if (rand()%(4<<(i/dev_dur)) == 0)
+		if (rng_next()%(4<<(i/dev_dur)) == 0)
 		{
 			n->dur ^= mask;
 		}
@@ -170,46 +356,178 @@ void mutate_note(note* n, int upper_lim)
 		n->start = upper_lim - n->dur;
 	}
 	
-	// Mutate volume
-	for (i=0; i<8; i++)
+	mutate_volume(n);
+}
+
+// Mutates a note whose times are kept on grid g. The grid line it starts on and
+// its length in lines are mutated like mutate_note mutates sample times, each
+// bit as often as the bit of a sample time of the same size, but only over the
+// bits needed to address the grid. A note shorter than a line has a length of
+// 0 lines and keeps its duration in samples, whose bits below a line are
+// mutated as mutate_note would, so that short notes are not forced to last a
+// whole line. Its offset from the line (up to g->jitter samples) is
+// occasionally redrawn.
+void mutate_grid_note(note* n, int upper_lim, note_grid* g)
+{
+	int i, k, len, mask, dev_start = 3, dev_dur = 2;
+	int sb = (int)log2(g->step); // Bit of sample times that a grid step is
+	long long off, t, dur;
+	
+	k = grid_line(g, n->start);
+	off = (long long)n->start-line_sample(g, k);
+	len = (n->dur < g->step) ? 0 : (int)(n->dur/g->step+0.5);
+	// Duration below a line: the note's own, or the part of it under a line
+	dur = (len == 0) ? n->dur : (n->dur & ((1<<sb)-1));
+	
+	mutate_pitch(n);
+	
+	for (i=0; (1<<i) < g->lines; i++)
 	{
 		mask = 1<<i;
-		if (rand()%(4<<(i)) == 0)
-		{
-			n->volume ^= mask;
-		}
+		if (rng_next()%(4<<((i+sb)/dev_start)) == 0) k ^= mask;
+		if (rng_next()%(4<<((i+sb)/dev_dur)) == 0) len ^= mask;
+	}
+	for (i=0; i<sb; i++)
+	{
+		if (rng_next()%(4<<(i/dev_dur)) == 0) dur ^= 1<<i;
 	}
+	if (k >= g->lines) k = g->lines-1;
+	if (len == 0 && dur >= g->step) len = 1;
+	if (g->jitter > 0 && rng_next()%8 == 0) off = (long long)(rng_next()%(2*g->jitter+1))-g->jitter;
+	
+	// Notes outside the bounds of the input song are useless, so move them back
+	t = line_sample(g, k)+off;
+	n->dur = (len > 0) ? (unsigned int)(len*g->step+0.5) : dur;
+	if (n->dur > upper_lim) n->dur = upper_lim;
+	if (t+n->dur > upper_lim) t = upper_lim-n->dur;
+	n->start = (t < 0) ? 0 : t;
+	snap_note(n, g, upper_lim);
+	
+	mutate_volume(n);
 }
 
 // Initializes a new random note
 void randomize_note(note* n, int upper_lim)
 {
-	n->pitch = rand()%PIANO_KEYS;	// Random piano key
-	n->start = rand()%upper_lim;	// Start time will not exceed upper limit
-	n->dur = rand()%FS; 			// Random duration under a second
-	n->volume = rand()%256;			// Random 8 bit volume value
+	n->pitch = rng_next()%PIANO_KEYS;	// Random piano key
+	n->start = rng_next()%upper_lim;	// Start time will not exceed upper limit
+	n->dur = rng_next()%FS; 			// Random duration under a second
+	n->volume = rng_next()%256;			// Random 8 bit volume value
 }
 
-// Calculates initial error value (error from silence)
-double initial_err(double* goal, int tsize)
+// Sum of squared differences between a and b over n points (the sum of squares
+// of a if b is NULL), using SIMD instructions when the compiler provides them
+static double sq_err(double* a, double* b, int n)
 {
-	int i;
-	double total = 0;
-	for (i=0; i<tsize; i++)
+	int i = 0;
+	double d, total = 0;
+#if defined(__AVX__)
+	double part[4];
+	__m256d d0, d1, s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+	// Two accumulators hide the latency of the additions
+	for (; i+8 <= n; i+=8)
+	{
+		d0 = _mm256_loadu_pd(a+i);
+		d1 = _mm256_loadu_pd(a+i+4);
+		if (b != NULL)
+		{
+			d0 = _mm256_sub_pd(d0, _mm256_loadu_pd(b+i));
+			d1 = _mm256_sub_pd(d1, _mm256_loadu_pd(b+i+4));
+		}
+		s0 = _mm256_add_pd(s0, _mm256_mul_pd(d0, d0));
+		s1 = _mm256_add_pd(s1, _mm256_mul_pd(d1, d1));
+	}
+	_mm256_storeu_pd(part, _mm256_add_pd(s0, s1));
+	total = (part[0]+part[1])+(part[2]+part[3]);
+#elif defined(__SSE2__)
+	double part[2];
+	__m128d d0, d1, s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+	// Two accumulators hide the latency of the additions
+	for (; i+4 <= n; i+=4)
+	{
+		d0 = _mm_loadu_pd(a+i);
+		d1 = _mm_loadu_pd(a+i+2);
+		if (b != NULL)
+		{
+			d0 = _mm_sub_pd(d0, _mm_loadu_pd(b+i));
+			d1 = _mm_sub_pd(d1, _mm_loadu_pd(b+i+2));
+		}
+		s0 = _mm_add_pd(s0, _mm_mul_pd(d0, d0));
+		s1 = _mm_add_pd(s1, _mm_mul_pd(d1, d1));
+	}
+	_mm_storeu_pd(part, _mm_add_pd(s0, s1));
+	total = part[0]+part[1];
+#endif
+	// Remaining points (or all of them without SIMD support)
+	for (; i<n; i++)
 	{
-		total += goal[i]*goal[i];
+		d = (b != NULL) ? a[i]-b[i] : a[i];
+		total += d*d;
 	}
 	return total;
 }
 
+// Adds the squared differences between a and b (the squares of a if b is NULL)
+// to acc point by point over n points, so that summing the rows of a transform
+// gives the error of each column. Uses SIMD instructions like sq_err.
+void add_sq_err(double* a, double* b, int n, double* acc)
+{
+	int i = 0;
+	double d;
+#if defined(__AVX__)
+	__m256d d0;
+	for (; i+4 <= n; i+=4)
+	{
+		d0 = _mm256_loadu_pd(a+i);
+		if (b != NULL) d0 = _mm256_sub_pd(d0, _mm256_loadu_pd(b+i));
+		_mm256_storeu_pd(acc+i, _mm256_add_pd(_mm256_loadu_pd(acc+i), _mm256_mul_pd(d0, d0)));
+	}
+#elif defined(__SSE2__)
+	__m128d d0;
+	for (; i+2 <= n; i+=2)
+	{
+		d0 = _mm_loadu_pd(a+i);
+		if (b != NULL) d0 = _mm_sub_pd(d0, _mm_loadu_pd(b+i));
+		_mm_storeu_pd(acc+i, _mm_add_pd(_mm_loadu_pd(acc+i), _mm_mul_pd(d0, d0)));
+	}
+#endif
+	// Remaining points (or all of them without SIMD support)
+	for (; i<n; i++)
+	{
+		d = (b != NULL) ? a[i]-b[i] : a[i];
+		acc[i] += d*d;
+	}
+}
+
+// Calculates initial error value (error from silence)
+double initial_err(double* goal, int tsize)
+{
+	return sq_err(goal, NULL, tsize);
+}
+
 // Calculates a total error value (sum of squared individual errors)
 double error_fn(double* tform, double* goal, int tsize)
 {
-	int i;
+	return sq_err(tform, goal, tsize);
+}
+
+// Calculates the total error like error_fn, but stops as soon as it exceeds
+// bound: an individual that is already worse than the bound has lost. Returns
+// the (possibly partial) total and sets done to the number of points summed.
+double error_fn_bound(double* tform, double* goal, int tsize, double bound, int* done)
+{
+	int i, n;
 	double total = 0;
-	for (i=0; i<tsize; i++)
+	for (i=0; i<tsize; i+=n)
 	{
-		total += (tform[i]-goal[i])*(tform[i]-goal[i]);
+		n = (tsize-i < ERR_CHUNK) ? tsize-i : ERR_CHUNK;
+		total += sq_err(tform+i, goal+i, n);
+		if (total > bound)
+		{
+			*done = i+n;
+			return total;
+		}
 	}
+	*done = tsize;
 	return total;
-}
+}
\ No newline at end of file
@@ -2,13 +2,58 @@
 #define GA
 
 #include "song.h"
+#include "selection.h"
+#include "eval.h"
+#include "output.h"
+#include "grid.h"
+
+#define ERR_CHUNK 256	// Points summed between checks of the bound in error_fn_bound
+
+// Settings for the genetic algorithm
+typedef struct ga_info
+{
+	int sel_type;	// Selection strategy (SEL_ROULETTE, SEL_TOURNAMENT or SEL_RANK)
+	int tour_size;	// Number of individuals competing in each tournament
+	eval_info* ev;	// Evaluates children as they are created (NULL: leave unscored)
+	int gens;		// Number of generations to run
+	int pop_size;	// Number of individuals (multiple of 4)
+	int est_notes;	// Number of notes in each initial individual
+	int islands;	// Number of island processes (1: a single population)
+	int mig_int;	// Generations between migrations between islands
+	char* ckpt;		// Checkpoint file to write (NULL: no checkpoints)
+	int ckpt_int;	// Generations between checkpoints
+	char* resume;	// Checkpoint file to resume from (NULL: start a new population)
+	out_info* out;	// Writes songs as evolution runs (NULL: no output)
+	int ls_int;		// Generations between volume refinements (0: never refine)
+	int ls_top;		// Number of best songs whose volumes are refined
+	int seed;		// Whether to look for notes in the input to start from
+	note* seeds;	// Notes found in the input to start from, strongest first
+	int nseeds;		// Number of seed notes (0: start from random songs)
+	int mf_levels;	// Number of coarser transforms songs are screened on (0: none)
+	double mf_keep;	// Fraction of screened songs promoted to the next finer transform
+	int elite;		// Number of best songs always carried over to the next generation
+	double offspring;	// Fraction of the population replaced by children each generation
+	int verbose;	// Whether to print progress after each generation
+	int quant;		// Whether to keep note times on a tempo grid
+	double bpm;		// Tempo of the grid (0: estimate it, but slow pieces come out doubled)
+	int sub;		// Grid lines per beat
+	double jitter;	// Seconds a note may start off its grid line
+	note_grid* grid;	// Grid set up from the above (NULL: notes start on any sample)
+} ga_info;
 
 void gen_pop(song* pop, int pop_size, int est_notes, int upper_lim);
-void mutate_pop(song** pop, int pop_size, int upper_lim);
+void init_pop(song* pop, ga_info* gi, int upper_lim);
+int evolve(ga_info* gi, int upper_lim, song* best);
+void mutate_pop(song** pop, int pop_size, int upper_lim, ga_info* gi);
+int child_count(int pop_size, ga_info* gi);
+int best_ind(song* pop, int pop_size);
 void splice(song* in1, song* in2, song* out1, song* out2);
 void mutate_note(note* n, int upper_lim);
+void mutate_grid_note(note* n, int upper_lim, note_grid* g);
 void randomize_note(note* n, int upper_lim);
 double initial_err(double* goal, int tsize);
 double error_fn(double* tform, double* goal, int tsize);
+double error_fn_bound(double* tform, double* goal, int tsize, double bound, int* done);
+void add_sq_err(double* a, double* b, int n, double* acc);
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
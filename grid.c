@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <math.h>
+#include "grid.h"
+
+// Estimates the tempo of a normalized transform from its onsets: the rise in
+// energy from each column to the next, summed over the rows. The beat period is
+// the lag between columns at which the onsets correlate best, weighted towards
+// GRID_PRIOR_BPM so that double and half tempos only win when they fit better,
+// and the beat falls on the columns with the most onset energy. Sets beat to the
+// time in seconds of a beat and returns the tempo in beats per minute, or 0 if
+// the transform is too short or too coarse to find one.
+// Onsets alone cannot tell a slow piece in eighth notes from one twice as fast
+// in quarter notes, so a slow piece (72 bpm, say) is found at double its tempo.
+// Every line of its grid is then still a line of the doubled grid, which only
+// has twice as many lines to search; the tempo of slow pieces should be given.
+double estimate_tempo(double* tform, process_info* pi, double* beat)
+{
+	int i, x, y, k, lag, lmin, lmax, best = 0, ph, w = pi->width;
+	double d, mean = 0, ac, score, best_score = 0, prev, next, period, sum, best_sum = -1;
+	double dt = (pi->et-pi->st)/w;	// Seconds per column
+	double* onset;
+
+	lmin = (int)floor(60.0/GRID_MAX_BPM/dt);
+	lmax = (int)ceil(60.0/GRID_MIN_BPM/dt);
+	if (lmin < 2) lmin = 2;
+	if (lmax > w/2) lmax = w/2;
+	if (lmax <= lmin) return 0;
+
+	onset = calloc(w, sizeof(double));
+	for (y=0; y<pi->height; y++)
+	{
+		for (x=1; x<w; x++)
+		{
+			d = tform[y*w+x]-tform[y*w+x-1];
+			if (d > 0) onset[x] += d;
+		}
+	}
+	for (x=0; x<w; x++)
+	{
+		mean += onset[x]/w;
+	}
+	for (x=0; x<w; x++)
+	{
+		onset[x] -= mean;
+	}
+
+	// Autocorrelation of the onsets
+	for (lag=lmin; lag<=lmax; lag++)
+	{
+		ac = 0;
+		for (x=0; x+lag<w; x++)
+		{
+			ac += onset[x]*onset[x+lag];
+		}
+		ac /= w-lag;
+		// Log-gaussian preference for tempos near GRID_PRIOR_BPM, an octave wide
+		d = log2(60.0/(lag*dt)/GRID_PRIOR_BPM);
+		score = ac*exp(-0.5*d*d);
+		if (score > best_score)
+		{
+			best_score = score;
+			best = lag;
+		}
+	}
+	if (best == 0)
+	{
+		free(onset);
+		return 0;
+	}
+
+	// Refine the period between columns with a parabola through the peak
+	prev = next = ac = 0;
+	for (x=0; x+best+1<w; x++)
+	{
+		prev += onset[x]*onset[x+best-1];
+		ac += onset[x]*onset[x+best];
+		next += onset[x]*onset[x+best+1];
+	}
+	period = best;
+	d = prev-2*ac+next;
+	if (d < 0 && fabs(0.5*(prev-next)/d) < 1) period += 0.5*(prev-next)/d;
+
+	// Beat phase: the offset whose beats land on the most onset energy
+	ph = 0;
+	for (x=0; x<best; x++)
+	{
+		sum = 0;
+		for (k=0; (i = (int)(x+k*period+0.5)) < w; k++)
+		{
+			sum += onset[i];
+		}
+		if (sum > best_sum)
+		{
+			best_sum = sum;
+			ph = x;
+		}
+	}
+	free(onset);
+	*beat = pi->st+ph*dt;
+	return 60.0/(period*dt);
+}
+
+// Sets up a grid of sub lines per beat at tempo bpm, estimating the tempo and
+// beat from the normalized transform tform (see estimate_tempo) if bpm is 0.
+// Notes may start up to jitter seconds off a line. upper_lim is the length of
+// the input in samples. Returns -1 if no tempo could be estimated.
+int init_grid(note_grid* g, double bpm, int sub, double jitter, double* tform,
+		process_info* pi, int upper_lim)
+{
+	double beat = 0;
+
+	if (bpm <= 0) bpm = estimate_tempo(tform, pi, &beat);
+	if (bpm <= 0 || sub < 1) return -1;
+	g->bpm = bpm;
+	g->step = 60.0*FS/bpm/sub;
+	// Line 0 is the first beat line at or before the start of the input
+	g->origin = beat*FS;
+	g->origin -= ceil(g->origin/g->step)*g->step;
+	g->lines = (int)((upper_lim-g->origin)/g->step)+1;
+	g->jitter = (int)(jitter*FS);
+	return 0;
+}
+
+// Grid line nearest sample t
+int grid_line(note_grid* g, long long t)
+{
+	int k = (int)floor((t-g->origin)/g->step+0.5);
+	if (k < 0) k = 0;
+	if (k >= g->lines) k = g->lines-1;
+	return k;
+}
+
+// Sample of grid line k
+long long line_sample(note_grid* g, int k)
+{
+	long long t = (long long)ceil(g->origin+k*g->step);
+	return (t < 0) ? 0 : t;
+}
+
+// Moves a note to the grid: its start to the nearest line (keeping up to
+// g->jitter samples of its offset) and its duration, unless it is shorter than
+// a line, to a whole number of lines
+void snap_note(note* n, note_grid* g, int upper_lim)
+{
+	long long t, off, dur;
+	int k = grid_line(g, n->start);
+
+	t = line_sample(g, k);
+	off = (long long)n->start-t;
+	if (off > g->jitter) off = g->jitter;
+	if (off < -g->jitter) off = -g->jitter;
+	t += off;
+	if (t < 0) t = 0;
+	dur = n->dur;
+	if (dur >= g->step) dur = (long long)(floor(dur/g->step+0.5)*g->step+0.5);
+	if (t+dur > upper_lim) dur = upper_lim-t;
+	if (dur < 0) dur = 0;
+	n->start = t;
+	n->dur = dur;
+}
+
+// Moves every note of a song to the grid (see snap_note)
+void snap_song(song* s, note_grid* g, int upper_lim)
+{
+	int i;
+	note n;
+
+	for (i=0; i < s->size; i++)
+	{
+		n = get_note(s, i);
+		snap_note(&n, g, upper_lim);
+		set_note(s, i, n);
+	}
+	sort_song(s);
+}
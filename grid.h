@@ -0,0 +1,30 @@
+#ifndef GRID
+#define GRID
+
+#include "song.h"
+#include "transform.h"
+
+#define GRID_MIN_BPM 40		// Slowest tempo considered when estimating one
+#define GRID_MAX_BPM 240	// Fastest tempo considered when estimating one
+#define GRID_PRIOR_BPM 120	// Tempo the estimate favours when others fit as well
+#define GRID_SUB 4			// Default grid lines per beat
+
+// Grid of times that notes start and end on in quantized mode
+typedef struct note_grid
+{
+	double bpm;		// Tempo in beats per minute
+	double origin;	// Sample of grid line 0 (a beat)
+	double step;	// Samples between grid lines
+	int lines;		// Grid lines up to the end of the input
+	int jitter;		// Most samples a note may start off its grid line
+} note_grid;
+
+double estimate_tempo(double* tform, process_info* pi, double* beat);
+int init_grid(note_grid* g, double bpm, int sub, double jitter, double* tform,
+		process_info* pi, int upper_lim);
+int grid_line(note_grid* g, long long t);
+long long line_sample(note_grid* g, int k);
+void snap_note(note* n, note_grid* g, int upper_lim);
+void snap_song(song* s, note_grid* g, int upper_lim);
+
+#endif
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "island.h"
+#include "rng.h"
+#include "refine.h"
+#include "eval.h"
+
+// Memory shared by all island processes
+typedef struct island_shm
+{
+	pthread_barrier_t barrier;	// Synchronizes migrations
+	migrant slots[];			// Outgoing migrant of each island
+} island_shm;
+
+// Copies a song into a shared memory slot. Notes beyond MIG_NOTES are dropped,
+// and the song is then scored again with ev so the slot's score matches its notes.
+static void to_migrant(song* s, migrant* m, eval_info* ev)
+{
+	int i;
+	song t;
+	
+	m->size = (s->size < MIG_NOTES) ? s->size : MIG_NOTES;
+	for (i=0; i < m->size; i++)
+	{
+		m->notes[i] = get_note(s, i);
+	}
+	m->err = s->err;
+	m->fitness = s->fitness;
+	m->screened = s->screened;
+	if (m->size < s->size)
+	{
+		init_song(&t);
+		add_notes(m->notes, m->size, &t);
+		eval_song(&t, ev);
+		m->err = t.err;
+		m->fitness = t.fitness;
+		m->screened = t.screened;
+		dest_song(&t);
+	}
+}
+
+// Creates a song from a shared memory slot
+static void from_migrant(migrant* m, song* s)
+{
+	init_song(s);
+	add_notes(m->notes, m->size, s);
+	s->err = m->err;
+	s->fitness = m->fitness;
+	s->done = 1;
+	s->screened = m->screened;
+	s->parent1 = -1;
+	s->parent2 = -1;
+}
+
+// Returns the index of the least fit individual
+static int worst_ind(song* pop, int pop_size)
+{
+	int i, worst = 0;
+	for (i=1; i<pop_size; i++)
+	{
+		if (pop[i].fitness < pop[worst].fitness ||
+				(pop[i].fitness == pop[worst].fitness && pop[i].err > pop[worst].err))
+		{
+			worst = i;
+		}
+	}
+	return worst;
+}
+
+// Evolves the sub-population of island number id. Every gi->mig_int generations
+// the island publishes its best song and replaces its worst song with the
+// best song of the previous island in the ring.
+static void island_main(island_shm* shm, int id, ga_info* gi, int upper_lim)
+{
+	int i, w, n = gi->islands;
+	song* pop;
+	
+	// Each process inherited the same RNG state, so give each its own sequence
+	rng_seed(time(NULL) ^ ((unsigned long long)getpid()<<32));
+	
+	pop = malloc(gi->pop_size*sizeof(song));
+	init_pop(pop, gi, upper_lim);
+	eval_pop(pop, gi->pop_size, NULL, gi->ev);
+	
+	for (i=1; i <= gi->gens; i++)
+	{
+		mutate_pop(&pop, gi->pop_size, upper_lim, gi);
+		if (gi->ls_int > 0 && i%gi->ls_int == 0)
+		{
+			refine_pop(pop, gi->pop_size, gi->ls_top, gi->ev);
+		}
+		
+		if (i%gi->mig_int == 0 && i < gi->gens)
+		{
+			to_migrant(&pop[best_ind(pop, gi->pop_size)], &shm->slots[id], gi->ev);
+			pthread_barrier_wait(&shm->barrier);
+			
+			// Take in the previous island's best song
+			w = worst_ind(pop, gi->pop_size);
+			dest_song(&pop[w]);
+			from_migrant(&shm->slots[(id+n-1)%n], &pop[w]);
+			if (gi->verbose)
+			{
+				printf("Island %d, generation %d: best error %g\n", id, i,
+						pop[best_ind(pop, gi->pop_size)].err);
+			}
+			
+			// Slots must not be overwritten until every island has read its migrant
+			pthread_barrier_wait(&shm->barrier);
+		}
+	}
+	
+	// Publish the final result
+	to_migrant(&pop[best_ind(pop, gi->pop_size)], &shm->slots[id], gi->ev);
+	for (i=0; i < gi->pop_size; i++)
+	{
+		dest_song(&pop[i]);
+	}
+	free(pop);
+}
+
+// Runs the genetic algorithm as gi->islands worker processes, each evolving
+// gi->pop_size/gi->islands individuals, and sets best to the best song found
+// by any island. The evaluation settings in gi->ev are shared by every island.
+int run_islands(ga_info* gi, int upper_lim, song* best)
+{
+	int i, n = gi->islands, status, failed = 0, running, b = 0;
+	size_t size = sizeof(island_shm)+n*sizeof(migrant);
+	pid_t pid, *pids;
+	pthread_barrierattr_t attr;
+	island_shm* shm;
+	ga_info igi = *gi;
+	
+	// Split the population between the islands (mutate_pop needs multiples of 4)
+	igi.pop_size = (gi->pop_size/n) & ~3;
+	if (igi.pop_size < 4)
+	{
+		printf("Population of %d is too small for %d islands of 4 songs.\n", gi->pop_size, n);
+		return -1;
+	}
+	if (igi.mig_int < 1) igi.mig_int = 1;
+	
+	shm = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+	{
+		perror("Error creating shared memory");
+		return -1;
+	}
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(&shm->barrier, &attr, n);
+	pthread_barrierattr_destroy(&attr);
+	
+	// Make sure buffered output is not duplicated in the children
+	fflush(stdout);
+	pids = malloc(n*sizeof(pid_t));
+	for (i=0; i<n; i++)
+	{
+		pids[i] = fork();
+		if (pids[i] < 0)
+		{
+			// Without every island the others would wait at the barrier forever
+			perror("Error starting island");
+			while (--i >= 0)
+			{
+				kill(pids[i], SIGKILL);
+				waitpid(pids[i], NULL, 0);
+			}
+			failed = 1;
+			break;
+		}
+		if (pids[i] == 0)
+		{
+			island_main(shm, i, &igi, upper_lim);
+			fflush(stdout);
+			_exit(0);
+		}
+	}
+	
+	// Wait for the islands to finish. If one fails, the others would wait at the
+	// barrier forever, so stop them too.
+	for (running = failed ? 0 : n; running > 0; )
+	{
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) break;
+		for (i=0; i<n && pids[i]!=pid; i++);
+		if (i == n) continue; // Not an island
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			printf("Island %d failed.\n", i);
+			if (!failed)
+			{
+				for (i=0; i<n; i++) kill(pids[i], SIGKILL);
+			}
+			failed = 1;
+		}
+	}
+	
+	if (!failed)
+	{
+		for (i=1; i<n; i++)
+		{
+			if (shm->slots[i].fitness > shm->slots[b].fitness ||
+					(shm->slots[i].fitness == shm->slots[b].fitness &&
+					shm->slots[i].err < shm->slots[b].err))
+			{
+				b = i;
+			}
+		}
+		from_migrant(&shm->slots[b], best);
+	}
+	
+	pthread_barrier_destroy(&shm->barrier);
+	munmap(shm, size);
+	free(pids);
+	return failed ? -1 : 0;
+}
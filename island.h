@@ -0,0 +1,21 @@
+#ifndef ISLAND
+#define ISLAND
+
+#include "song.h"
+#include "ga.h"
+
+#define MIG_NOTES 1024	// Most notes a migrating song can carry
+
+// A song as stored in shared memory between island processes
+typedef struct migrant
+{
+	int size;				// Number of notes (at most MIG_NOTES)
+	double err;				// Error of the song
+	double fitness;			// Fitness of the song
+	int screened;			// Coarse level the error was estimated on (see song)
+	note notes[MIG_NOTES];	// Notes of the song
+} migrant;
+
+int run_islands(ga_info* gi, int upper_lim, song* best);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "piano.h"
+#include "bmp_write.h"
+#include "prof.h"
+
+// Writes the artifacts of one song. Runs on the writer thread, so it only
+// reads shared data (piano notes, goal transform settings and kernels).
+static void write_job(out_info* out, out_job* job, double* tform, double* tphase)
+{
+	char filename[4096];
+	int* signal;
+	double max;
+	wav_info header = *out->ev->header;
+	process_info pi = *out->ev->pi;
+	long long start = prof_start();
+	
+	snprintf(filename, sizeof(filename), "%s/%d", out->dir, job->gen);
+	mkdir(filename, 0777); // Fails harmlessly if it exists
+	
+	if (out->kinds & OUT_TXT)
+	{
+		snprintf(filename, sizeof(filename), "%s/%d/%d.txt", out->dir, job->gen, job->rank);
+		write_song(&job->s, filename);
+	}
+	if (out->kinds & (OUT_WAV|OUT_BMP))
+	{
+		render_music(&job->s, out->ev->notes, &signal, &header);
+		if (out->kinds & OUT_WAV)
+		{
+			// Rendered songs have a single channel
+			make_mono(&header);
+			snprintf(filename, sizeof(filename), "%s/%d/%d.wav", out->dir, job->gen, job->rank);
+			write_wav(filename, &header, signal);
+		}
+		if (out->kinds & OUT_BMP)
+		{
+			// Scale the image to the song's own maximum, like the input's image
+			pi.norm = 0;
+			max = wavelet_cols(out->ev->kb, &header, out->ev->datalen, &pi, signal,
+					0, pi.width, tform, tphase);
+			normalize_transform(tform, pi.width*pi.height, max);
+			snprintf(filename, sizeof(filename), "%s/%d/%d.bmp", out->dir, job->gen, job->rank);
+			writeToImage(filename, &pi, tform, tphase);
+		}
+		free(signal);
+	}
+	prof_stop(PROF_OUTPUT, start);
+}
+
+// Writer thread: writes queued songs until told to stop and the queue is empty
+static void* writer_main(void* arg)
+{
+	out_info* out = arg;
+	out_job job;
+	int tsize = out->ev->pi->width*out->ev->pi->height;
+	double* tform = malloc(tsize*sizeof(double));
+	double* tphase = malloc(tsize*sizeof(double));
+	
+	pthread_mutex_lock(&out->lock);
+	for (;;)
+	{
+		while (out->len == 0 && !out->stop)
+		{
+			pthread_cond_wait(&out->ready, &out->lock);
+		}
+		if (out->len == 0) break; // Stopped and nothing left to write
+		job = out->queue[out->head];
+		out->head = (out->head+1)%OUT_QUEUE;
+		out->len--;
+		
+		// Write without holding the lock so the GA can keep queueing
+		pthread_mutex_unlock(&out->lock);
+		write_job(out, &job, tform, tphase);
+		dest_song(&job.s);
+		pthread_mutex_lock(&out->lock);
+		out->written++;
+	}
+	pthread_mutex_unlock(&out->lock);
+	
+	free(tform);
+	free(tphase);
+	return NULL;
+}
+
+// Starts the writer thread. ev supplies the header and transform settings
+// used to render songs. Returns 0 on success, -1 on failure.
+int start_output(out_info* out, eval_info* ev)
+{
+	out->ev = ev;
+	out->head = 0;
+	out->len = 0;
+	out->stop = 0;
+	out->written = 0;
+	out->dropped = 0;
+	if (out->every < 1) out->every = 1;
+	if (out->top_k < 1) out->top_k = 1;
+	mkdir(out->dir, 0777);
+	
+	pthread_mutex_init(&out->lock, NULL);
+	pthread_cond_init(&out->ready, NULL);
+	if (pthread_create(&out->thread, NULL, writer_main, out) != 0)
+	{
+		printf("Error starting output thread.\n");
+		pthread_mutex_destroy(&out->lock);
+		pthread_cond_destroy(&out->ready);
+		return -1;
+	}
+	return 0;
+}
+
+// Queues the top_k songs of a generation for writing if the generation is due.
+// Never waits for the disk: songs that do not fit in the queue are dropped.
+void output_gen(out_info* out, song* pop, int pop_size, int gen)
+{
+	int i, k, b, idx, n = (out->top_k < pop_size) ? out->top_k : pop_size;
+	char* taken;
+	
+	if (gen%out->every != 0) return;
+	
+	taken = calloc(pop_size, 1);
+	for (k=0; k<n; k++)
+	{
+		// Find the k-th best song (top_k is small, so a scan per song is fine)
+		b = -1;
+		for (i=0; i<pop_size; i++)
+		{
+			if (!taken[i] && (b < 0 || pop[i].fitness > pop[b].fitness ||
+					(pop[i].fitness == pop[b].fitness && pop[i].err < pop[b].err)))
+			{
+				b = i;
+			}
+		}
+		taken[b] = 1;
+		
+		pthread_mutex_lock(&out->lock);
+		if (out->len == OUT_QUEUE)
+		{
+			out->dropped++;
+		}
+		else
+		{
+			idx = (out->head+out->len)%OUT_QUEUE;
+			copy_song(&pop[b], &out->queue[idx].s);
+			out->queue[idx].gen = gen;
+			out->queue[idx].rank = k;
+			out->len++;
+			pthread_cond_signal(&out->ready);
+		}
+		pthread_mutex_unlock(&out->lock);
+	}
+	free(taken);
+}
+
+// Writes the remaining queued songs and stops the writer thread
+void stop_output(out_info* out)
+{
+	pthread_mutex_lock(&out->lock);
+	out->stop = 1;
+	pthread_cond_signal(&out->ready);
+	pthread_mutex_unlock(&out->lock);
+	pthread_join(out->thread, NULL);
+	
+	pthread_mutex_destroy(&out->lock);
+	pthread_cond_destroy(&out->ready);
+	printf("%ld songs written to %s, %ld skipped.\n", out->written, out->dir, out->dropped);
+}
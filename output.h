@@ -0,0 +1,44 @@
+#ifndef OUTPUT
+#define OUTPUT
+
+#include <pthread.h>
+#include "song.h"
+#include "eval.h"
+
+#define OUT_TXT 1		// Write each song's notes (write_song)
+#define OUT_WAV 2		// Write each song's rendered audio (write_wav)
+#define OUT_BMP 4		// Write each song's transform (writeToImage)
+#define OUT_QUEUE 16	// Songs waiting to be written before more are dropped
+
+// A song waiting to be written
+typedef struct out_job
+{
+	song s;		// Copy of the song
+	int gen;	// Generation it belongs to
+	int rank;	// Position in that generation (0: best)
+} out_job;
+
+// Settings and state of the artifact writer
+typedef struct out_info
+{
+	char* dir;		// Directory to write into: files go in dir/<generation>/
+	int every;		// Generations between outputs
+	int top_k;		// Number of best songs written each time
+	int kinds;		// Artifacts to write (OUT_TXT, OUT_WAV and/or OUT_BMP)
+	eval_info* ev;	// Input header and transform settings for rendering
+	out_job queue[OUT_QUEUE];	// Songs waiting for the writer thread
+	int head;		// Index of the oldest waiting song
+	int len;		// Number of waiting songs
+	int stop;		// Set when the writer should finish the queue and exit
+	long written;	// Songs written
+	long dropped;	// Songs skipped because the queue was full
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+} out_info;
+
+int start_output(out_info* out, eval_info* ev);
+void output_gen(out_info* out, song* pop, int pop_size, int gen);
+void stop_output(out_info* out);
+
+#endif
@@ -1,78 +1,105 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "piano.h"
+#include "prof.h"
 
-
-// Renders a song into an actual audio signal
+// Renders a song into an actual audio signal with the piano bank notes
 // Assumes all piano audio files are exactly 10 seconds and the note starts at 1 second
-void render_music(song* s, int** signal, wav_info* header)
+void render_music(song* s, int** notes, int** signal, wav_info* header)
 {
-	note n;
-	int i, j, sig, siglen, offset;
+	int siglen = get_data_len(header);
 	
-	siglen = get_data_len(header);
-	*signal = malloc(siglen*sizeof(int));
 	// Initialize signal as silence
-	for (i=0; i<siglen; i++)
-	{
-		(*signal)[i] = 0;
-	}
+	*signal = calloc(siglen, sizeof(int));
+	render_window(s, notes, *signal, siglen, 0, siglen);
+}
+
+// Adds the samples of a song that fall in [a,b) to signal (of length siglen).
+// Only the notes that can reach the window are visited.
+void render_window(song* s, int** notes, int* signal, int siglen, long long a, long long b)
+{
+	int i, first, last, sig;
+	long long j, j0, j1, start;
+	int* pn;
+	int vol;
+	long long t = prof_start(), samples = 0;
+	
+	notes_in_window(s, a, b, &first, &last);
 	
 	// Add each note
-	for (i=0; i < s->size; i++)
+	for (i=first; i < last; i++)
 	{
-		n = s->notes[i];
+		start = s->start[i];
+		// Samples of the sound file to use: the file is 10 seconds long, the
+		// note lasts dur samples after its start, and nothing is written past
+		// siglen-NOTE_LEAD (the sum wraps like the unsigned values it is made of)
+		j1 = (unsigned int)(s->dur[i]+FS);
+		if (j1 > FS*10) j1 = FS*10;
+		if (start >= siglen) j1 = 0;
+		else if (j1 > siglen-start) j1 = siglen-start;
+		// Sample j of the file lands at signal[j+start-NOTE_LEAD]: keep it in [a,b)
+		j0 = a-start+NOTE_LEAD;
+		if (j0 < 0) j0 = 0;
+		if (j0 < NOTE_LEAD-start) j0 = NOTE_LEAD-start; // Before the start of the signal
+		if (j1 > b-start+NOTE_LEAD) j1 = b-start+NOTE_LEAD;
+		
+		pn = notes[s->pitch[i]];
+		// Signed, so negative samples scale like positive ones
+		vol = (int)s->volume[i]+1;
 		// Add each sample of the note
-		for (j=0; (j<(n.dur+FS) && j<(FS*10) && (j+n.start)<siglen); j++)
+		for (j=j0; j<j1; j++)
 		{
-			offset = j + n.start - FS;
-			if (offset >= 0)
-			{
-				// Scale note volume
-				sig = (piano_notes[n.pitch][j]*(n.volume+1))>>8;
-				// Superimpose note onto signal
-				(*signal)[offset] = (*signal)[offset] + sig;
-			}
+			// Scale note volume
+			sig = (pn[j]*vol)>>8;
+			// Superimpose note onto signal
+			signal[j+start-NOTE_LEAD] += sig;
 		}
+		if (j1 > j0) samples += j1-j0;
 	}
+	prof_add(PROF_SAMPLES, samples);
+	prof_stop(PROF_RENDER, t);
 }
 
-// Loads the piano sound files 0.wav to 87.wav from the ./notes folder 
-int init_piano()
+// Loads the piano sound files 0.wav to 87.wav from the folder dir into a new
+// bank, notes. Returns 0 on success, -1 if a file could not be read.
+int init_piano(int*** notes, char* dir)
 {
 	int i;
-	char filename[16];
+	char filename[4096];
 	FILE* fp;
 	wav_info header;
 	
-	piano_notes = malloc(PIANO_KEYS*sizeof(int*));
+	*notes = calloc(PIANO_KEYS, sizeof(int*));
 	for (i=0; i<PIANO_KEYS; i++)
 	{
 		// Generate filename and open file
-		sprintf(filename, "notes/%d.wav", i);
+		snprintf(filename, sizeof(filename), "%s/%d.wav", dir, i);
 		if (open_wav_r(filename,&fp)<0 || check_wav_header(fp,&header)<0)
 		{
 			printf("Error opening %s\n",filename);
+			dest_piano(*notes);
+			*notes = NULL;
 			return -1;
 		}
 		
-		read_signal(fp,&header,&piano_notes[i]); // Read note signal into piano_notes
+		read_signal(fp,&header,&(*notes)[i]); // Read note signal into the bank
 		
 		fclose(fp);
 	}
 	return 0;
 }
 
-// Frees all the memory associated with the piano note signals
-int dest_piano()
+// Frees all the memory associated with the piano note signals of a bank
+int dest_piano(int** notes)
 {
 	int i;
 	
+	if (notes == NULL) return 0;
 	for (i=0; i<PIANO_KEYS; i++)
 	{
-		free(piano_notes[i]); // First free memory for each of the notes
+		free(notes[i]); // First free memory for each of the notes
 	}
-	free(piano_notes); // Lastly free the array memory
+	free(notes); // Lastly free the array memory
 	
 	return 0;
 }
\ No newline at end of file
@@ -5,11 +5,12 @@
 #include "wav_rw.h"
 #define PIANO_KEYS 88	// Number of piano keys
 
-// Keeps track of all the signals used for each note of the piano
-int** piano_notes;
+// The signals of the notes of the piano (a bank, notes[key]) are loaded by
+// init_piano and only read afterwards, so one bank can be shared by threads
 
-void render_music(song* s, int** signal, wav_info* header);
-int init_piano();
-int dest_piano();
+void render_music(song* s, int** notes, int** signal, wav_info* header);
+void render_window(song* s, int** notes, int* signal, int siglen, long long a, long long b);
+int init_piano(int*** notes, char* dir);
+int dest_piano(int** notes);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "prof.h"
+
+// One timed stage on the trace
+typedef struct prof_event
+{
+	int stage;
+	int tid;			// Thread the stage ran on (numbered from 0 in order of first use)
+	long long start;	// Nanoseconds since init_prof
+	long long dur;		// Nanoseconds
+} prof_event;
+
+int prof_on = 0;	// Whether stages are being timed
+
+static char* stage_names[PROF_STAGES] = { "check_wav_header", "read_signal",
+	"init_kernels", "wavelet_cols", "normalize_transform", "writeToImage",
+	"mutate_pop", "eval_pop", "refine_pop", "output", "save_checkpoint_bg",
+	"write_tiles", "wavelet row", "render_window" };
+static char* counter_names[PROF_COUNTERS] = { "convolution taps",
+	"transform points convolved", "transform points interpolated", "note samples rendered" };
+
+static long long calls[PROF_STAGES], total[PROF_STAGES], counts[PROF_COUNTERS];
+static long long t0;
+static char* trace_file;
+static prof_event* events;	// Trace (NULL: not tracing)
+static long long nevents, dropped;
+static int next_tid;
+static __thread int tid = -1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Nanoseconds on a monotonic clock
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+// Starts timing stages if stats is set or a trace file is given. The trace is
+// written to the file by dest_prof. Returns -1 if the trace cannot be kept.
+int init_prof(int stats, char* trace)
+{
+	prof_on = stats || trace != NULL;
+	trace_file = trace;
+	if (trace != NULL)
+	{
+		events = malloc(PROF_MAX_EVENTS*sizeof(prof_event));
+		if (events == NULL)
+		{
+			perror("Trace");
+			prof_on = stats;
+			return -1;
+		}
+	}
+	t0 = now_ns();
+	return 0;
+}
+
+// Returns the start time to pass to prof_stop (0 if timing is off)
+long long prof_start()
+{
+	return prof_on ? now_ns() : 0;
+}
+
+// Records a stage that began at start. Safe to call from any thread; stages
+// timed in forked processes are lost with the process.
+void prof_stop(int stage, long long start)
+{
+	long long end;
+	if (!prof_on) return;
+	end = now_ns();
+	__atomic_add_fetch(&calls[stage], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&total[stage], end-start, __ATOMIC_RELAXED);
+	if (events == NULL || stage >= PROF_TRACED) return;
+
+	if (tid < 0) tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&lock);
+	if (nevents < PROF_MAX_EVENTS)
+	{
+		events[nevents].stage = stage;
+		events[nevents].tid = tid;
+		events[nevents].start = start-t0;
+		events[nevents].dur = end-start;
+		nevents++;
+	}
+	else dropped++;
+	pthread_mutex_unlock(&lock);
+}
+
+// Adds n to a work counter
+void prof_add(int counter, long long n)
+{
+	if (prof_on) __atomic_add_fetch(&counts[counter], n, __ATOMIC_RELAXED);
+}
+
+// Prints the time spent in each stage and the work counters
+void prof_report(FILE* fp)
+{
+	int i;
+	long long points;
+
+	fprintf(fp, "%-20s %10s %12s %12s\n", "Stage", "Calls", "Total (ms)", "Mean (us)");
+	for (i=0; i<PROF_STAGES; i++)
+	{
+		if (calls[i] == 0) continue;
+		fprintf(fp, "%-20s %10lld %12.3f %12.3f\n", stage_names[i], calls[i],
+				total[i]*1e-6, total[i]*1e-3/calls[i]);
+	}
+	for (i=0; i<PROF_COUNTERS; i++)
+	{
+		fprintf(fp, "%-30s %lld\n", counter_names[i], counts[i]);
+	}
+	points = counts[PROF_POINTS]+counts[PROF_INTERP];
+	if (points > 0)
+	{
+		fprintf(fp, "%.1f%% of transform points interpolated\n",
+				100.0*counts[PROF_INTERP]/points);
+	}
+	if (dropped > 0) fprintf(fp, "%lld trace events dropped\n", dropped);
+}
+
+// Writes the trace file, if one was requested, in the Chrome trace event format
+// (readable by chrome://tracing and Perfetto) and stops timing. Returns -1 if
+// the trace could not be written.
+int dest_prof()
+{
+	int i, pid = getpid();
+	long long e;
+	FILE* fp;
+
+	prof_on = 0;
+	if (events == NULL) return 0;
+	fp = fopen(trace_file, "w");
+	if (fp == NULL)
+	{
+		perror(trace_file);
+		free(events);
+		events = NULL;
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (i=0; i<next_tid; i++)
+	{
+		fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+				"\"tid\": %d, \"args\": {\"name\": \"%s %d\"}}", (i > 0) ? "," : "",
+				pid, i, (i == 0) ? "main" : "thread", i);
+	}
+	for (e=0; e<nevents; e++)
+	{
+		fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, "
+				"\"ts\": %.3f, \"dur\": %.3f}", stage_names[events[e].stage], pid,
+				events[e].tid, events[e].start*1e-3, events[e].dur*1e-3);
+	}
+	fprintf(fp, "\n]}\n");
+	free(events);
+	events = NULL;
+	if (fclose(fp) != 0)
+	{
+		perror(trace_file);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef PROF
+#define PROF
+
+#include <stdio.h>
+
+// Timed stages. Stages from PROF_TRACED on are too frequent to trace and only
+// appear in the statistics.
+#define PROF_HEADER 0		// check_wav_header
+#define PROF_READ 1			// read_signal
+#define PROF_KERNELS 2		// init_kernels
+#define PROF_TRANSFORM 3	// wavelet_cols
+#define PROF_NORMALIZE 4	// normalize_transform
+#define PROF_IMAGE 5		// writeToImage
+#define PROF_GEN 6			// mutate_pop
+#define PROF_EVAL 7			// eval_pop
+#define PROF_REFINE 8		// refine_pop
+#define PROF_OUTPUT 9		// Writing one song's files on the output thread
+#define PROF_CHECKPOINT 10	// Starting a background checkpoint (save_checkpoint_bg)
+#define PROF_TILES 11		// write_tiles
+#define PROF_TRACED 12
+#define PROF_ROW 12			// One row of wavelet_cols
+#define PROF_RENDER 13		// render_window
+#define PROF_STAGES 14
+
+// Work counters
+#define PROF_TAPS 0			// Multiply-adds of wavelet convolutions
+#define PROF_POINTS 1		// Transform points convolved
+#define PROF_INTERP 2		// Transform points interpolated between evaluated points (-us)
+#define PROF_SAMPLES 3		// Note samples rendered
+#define PROF_COUNTERS 4
+
+#define PROF_MAX_EVENTS (1<<20)	// Trace events kept in memory
+
+extern int prof_on;
+
+int init_prof(int stats, char* trace);
+long long prof_start();
+void prof_stop(int stage, long long start);
+void prof_add(int counter, long long n);
+void prof_report(FILE* fp);
+int dest_prof();
+
+#endif
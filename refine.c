@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "refine.h"
+#include "piano.h"
+#include "selection.h"
+#include "prof.h"
+
+// Transform of a single note rendered at full volume
+typedef struct note_tform
+{
+	int x0;			// First column the note affects
+	int x1;			// One past the last column the note affects
+	double* mag;	// Magnitudes of columns x0 to x1-1, row by row (NULL: silent)
+} note_tform;
+
+// Transforms note i of song s on its own over the columns it affects
+static void note_transform(song* s, int i, eval_info* ev, note_tform* nt)
+{
+	int y, w, width = ev->pi->width;
+	long long a, b;
+	note n = get_note(s, i);
+	song one;
+
+	nt->mag = NULL;
+	if (!note_cols(&n, ev, &nt->x0, &nt->x1))
+	{
+		nt->x0 = nt->x1 = 0;
+		return;
+	}
+
+	// At full volume render_music scales a note's samples by exactly 1
+	n.volume = 255;
+	init_song(&one);
+	add_note(n, &one);
+	render_window(&one, ev->notes, ev->sig, ev->datalen, 0, ev->datalen);
+	dest_song(&one);
+	wavelet_cols(ev->kb, ev->header, ev->datalen, ev->pi, ev->sig, nt->x0, nt->x1,
+			ev->tform, NULL);
+
+	w = nt->x1-nt->x0;
+	nt->mag = malloc(ev->pi->height*w*sizeof(double));
+	for (y=0; y < ev->pi->height; y++)
+	{
+		memcpy(nt->mag+y*w, ev->tform+y*width+nt->x0, w*sizeof(double));
+	}
+
+	// Leave the scratch signal silent (a note writes at most 10 seconds of samples)
+	a = (long long)n.start-FS;
+	b = a+FS*10;
+	if (a < 0) a = 0;
+	if (b > ev->datalen) b = ev->datalen;
+	if (a < b) memset(ev->sig+a, 0, (b-a)*sizeof(int));
+}
+
+// Dot product of two note transforms over the columns they share
+static double dot_notes(note_tform* p, note_tform* q, int height)
+{
+	int x, y, x0, x1, wp = p->x1-p->x0, wq = q->x1-q->x0;
+	double total = 0;
+
+	x0 = (p->x0 > q->x0) ? p->x0 : q->x0;
+	x1 = (p->x1 < q->x1) ? p->x1 : q->x1;
+	for (y=0; y<height; y++)
+	{
+		for (x=x0; x<x1; x++)
+		{
+			total += p->mag[y*wp+x-p->x0]*q->mag[y*wq+x-q->x0];
+		}
+	}
+	return total;
+}
+
+// Dot product of a note transform with the goal transform
+static double dot_goal(note_tform* p, double* goal, int width, int height)
+{
+	int x, y, w = p->x1-p->x0;
+	double total = 0;
+
+	for (y=0; y<height; y++)
+	{
+		for (x=p->x0; x < p->x1; x++)
+		{
+			total += p->mag[y*w+x-p->x0]*goal[y*width+x];
+		}
+	}
+	return total;
+}
+
+// Solves m*x = r in place for a symmetric positive definite n by n matrix m
+// (Cholesky decomposition). r is replaced by x. Returns -1 if m is singular.
+static int solve_spd(double* m, double* r, int n)
+{
+	int i, j, k;
+	double d;
+
+	// Factor m = L*L^T, storing L in the lower triangle
+	for (j=0; j<n; j++)
+	{
+		d = m[j*n+j];
+		for (k=0; k<j; k++)
+		{
+			d -= m[j*n+k]*m[j*n+k];
+		}
+		if (d <= 0) return -1;
+		m[j*n+j] = sqrt(d);
+		for (i=j+1; i<n; i++)
+		{
+			d = m[i*n+j];
+			for (k=0; k<j; k++)
+			{
+				d -= m[i*n+k]*m[j*n+k];
+			}
+			m[i*n+j] = d/m[j*n+j];
+		}
+	}
+
+	// Forward substitution with L, then back substitution with L^T
+	for (i=0; i<n; i++)
+	{
+		for (k=0; k<i; k++)
+		{
+			r[i] -= m[i*n+k]*r[k];
+		}
+		r[i] /= m[i*n+i];
+	}
+	for (i=n-1; i>=0; i--)
+	{
+		for (k=i+1; k<n; k++)
+		{
+			r[i] -= m[k*n+i]*r[k];
+		}
+		r[i] /= m[i*n+i];
+	}
+	return 0;
+}
+
+// Chooses the note volumes of s that best fit the goal transform, keeping its
+// pitches and times. A note at volume v is scaled by the gain (v+1)/256, and the
+// transform is linear, so the song's transform is modelled as the sum of its
+// notes' full-volume transforms times their gains and the gains are found by
+// least squares. The model is exact only where notes do not overlap (the
+// magnitudes of overlapping notes do not simply add), so the new volumes are
+// kept only if they lower the song's error. Returns 1 if s was changed.
+int refine_song(song* s, eval_info* ev)
+{
+	int i, j, p, q, v, nf, nout, pass, n = s->size, height = ev->pi->height;
+	int changed = 0, kept = 0;
+	double ridge = 0, bound, lo = 1/256.0, hi = 1;
+	double *a, *b, *g, *m, *r;
+	int* f;
+	char* fixed;
+	note_tform* nt;
+	song cand;
+
+	// The error must be exact to compare against: a screened song is first
+	// scored on the full transform, and songs that stopped early are not refined
+	if (n > 0 && s->screened) eval_song(s, ev);
+	if (n == 0 || s->done < 1) return 0;
+
+	nt = malloc(n*sizeof(note_tform));
+	a = malloc(n*n*sizeof(double));
+	b = malloc(n*sizeof(double));
+	g = malloc(n*sizeof(double));
+	m = malloc(n*n*sizeof(double));
+	r = malloc(n*sizeof(double));
+	f = malloc(n*sizeof(int));
+	fixed = calloc(n, 1);
+
+	// Normal equations a*g = b of the least squares problem
+	for (i=0; i<n; i++)
+	{
+		note_transform(s, i, ev, &nt[i]);
+		g[i] = (s->volume[i]+1)/256.0;
+		if (nt[i].mag == NULL) fixed[i] = 1; // Silent notes keep their volume
+	}
+	for (i=0; i<n; i++)
+	{
+		if (fixed[i])
+		{
+			b[i] = 0;
+			for (j=0; j<n; j++) a[i*n+j] = a[j*n+i] = 0;
+			continue;
+		}
+		b[i] = dot_goal(&nt[i], ev->goal, ev->pi->width, height);
+		for (j=i; j<n; j++)
+		{
+			a[i*n+j] = a[j*n+i] = fixed[j] ? 0 : dot_notes(&nt[i], &nt[j], height);
+		}
+		ridge += a[i*n+i];
+	}
+	// A little ridge keeps the system solvable when notes coincide
+	ridge = VOL_RIDGE*ridge/n;
+
+	// Gains the solution pushes out of range are fixed at the limit, and the
+	// remaining gains are solved again
+	for (pass=0; pass<n; pass++)
+	{
+		nf = 0;
+		for (i=0; i<n; i++)
+		{
+			if (!fixed[i]) f[nf++] = i;
+		}
+		if (nf == 0 || ridge <= 0) break;
+
+		for (p=0; p<nf; p++)
+		{
+			i = f[p];
+			r[p] = b[i];
+			for (j=0; j<n; j++)
+			{
+				if (fixed[j]) r[p] -= a[i*n+j]*g[j];
+			}
+			for (q=0; q<nf; q++)
+			{
+				m[p*nf+q] = a[i*n+f[q]];
+			}
+			m[p*nf+p] += ridge;
+		}
+		if (solve_spd(m, r, nf) < 0) break;
+
+		nout = 0;
+		for (p=0; p<nf; p++)
+		{
+			i = f[p];
+			g[i] = r[p];
+			if (g[i] < lo || g[i] > hi)
+			{
+				g[i] = (g[i] < lo) ? lo : hi;
+				fixed[i] = 1;
+				nout++;
+			}
+		}
+		if (nout == 0) break;
+	}
+
+	// Round the gains to volumes and score the result
+	copy_song(s, &cand);
+	for (i=0; i<n; i++)
+	{
+		v = (int)floor(g[i]*256-0.5);
+		if (v < 0) v = 0;
+		if (v > 255) v = 255;
+		if ((unsigned int)v != cand.volume[i]) changed = 1;
+		cand.volume[i] = v;
+	}
+	if (changed)
+	{
+		// Stop scoring as soon as the new volumes are no better
+		bound = ev->bound;
+		ev->bound = s->err;
+		eval_song(&cand, ev);
+		ev->bound = bound;
+		kept = (cand.done >= 1 && cand.err < s->err);
+	}
+	if (kept)
+	{
+		dest_song(s);
+		*s = cand;
+	}
+	else dest_song(&cand);
+
+	for (i=0; i<n; i++)
+	{
+		free(nt[i].mag);
+	}
+	free(nt);
+	free(a);
+	free(b);
+	free(g);
+	free(m);
+	free(r);
+	free(f);
+	free(fixed);
+	return kept;
+}
+
+// Refines the volumes of the top best songs of a population (see refine_song).
+// Returns the number of songs that were improved.
+int refine_pop(song* pop, int pop_size, int top, eval_info* ev)
+{
+	int i, kept = 0;
+	int* order = malloc(pop_size*sizeof(int));
+	long long start = prof_start();
+
+	if (top > pop_size) top = pop_size;
+	// The order lists the population from best to worst
+	rank_err(pop, pop_size, order);
+	for (i=0; i<top; i++)
+	{
+		kept += refine_song(&pop[order[i]], ev);
+	}
+	free(order);
+	prof_stop(PROF_REFINE, start);
+	return kept;
+}
@@ -0,0 +1,12 @@
+#ifndef REFINE
+#define REFINE
+
+#include "song.h"
+#include "eval.h"
+
+#define VOL_RIDGE 1e-6	// Ridge added to the volume system, relative to its mean diagonal
+
+int refine_song(song* s, eval_info* ev);
+int refine_pop(song* pop, int pop_size, int top, eval_info* ev);
+
+#endif
@@ -0,0 +1,52 @@
+#include "rng.h"
+
+// Random number generator used by the genetic algorithm (xoroshiro128**).
+// Unlike rand(), its state can be saved and restored, so a checkpointed run
+// continues with exactly the numbers it would have used. Each thread has its
+// own state.
+static __thread unsigned long long rng_s[2] = { 0x9E3779B97F4A7C15ULL, 0xD1B54A32D192ED03ULL };
+
+// Rotates x left by k bits
+static unsigned long long rotl(unsigned long long x, int k)
+{
+	return (x << k) | (x >> (64-k));
+}
+
+// Seeds the generator, spreading the seed over the state with splitmix64
+void rng_seed(unsigned long long seed)
+{
+	int i;
+	unsigned long long z;
+	for (i=0; i<2; i++)
+	{
+		z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		rng_s[i] = z ^ (z >> 31);
+	}
+}
+
+// Returns a random integer from 0 to RNG_MAX (a drop-in replacement for rand())
+int rng_next()
+{
+	unsigned long long s0 = rng_s[0], s1 = rng_s[1];
+	unsigned long long result = rotl(s0*5, 7)*9;
+	s1 ^= s0;
+	rng_s[0] = rotl(s0, 24) ^ s1 ^ (s1 << 16);
+	rng_s[1] = rotl(s1, 37);
+	return (int)(result >> 33);
+}
+
+// Copies the generator state into state
+void rng_get_state(unsigned long long state[2])
+{
+	state[0] = rng_s[0];
+	state[1] = rng_s[1];
+}
+
+// Restores a state saved by rng_get_state
+void rng_set_state(unsigned long long state[2])
+{
+	rng_s[0] = state[0];
+	rng_s[1] = state[1];
+}
@@ -0,0 +1,11 @@
+#ifndef RNG
+#define RNG
+
+#define RNG_MAX 0x7FFFFFFF	// Largest value returned by rng_next
+
+void rng_seed(unsigned long long seed);
+int rng_next();
+void rng_get_state(unsigned long long state[2]);
+void rng_set_state(unsigned long long state[2]);
+
+#endif
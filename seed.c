@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <math.h>
+#include "seed.h"
+#include "ga.h"
+#include "piano.h"
+#include "rng.h"
+
+// A note found in the transform and the height of its ridge
+typedef struct detected
+{
+	note n;
+	double peak;
+} detected;
+
+// Orders detected notes by decreasing ridge height
+static int cmp_detected(const void* a, const void* b)
+{
+	double pa = ((const detected*)a)->peak, pb = ((const detected*)b)->peak;
+	if (pa > pb) return -1;
+	if (pa < pb) return 1;
+	return 0;
+}
+
+// Whether row y of column x is a ridge: at least thresh and no smaller than
+// the rows next to it
+static int is_ridge(double* tform, process_info* pi, int y, int x, double thresh)
+{
+	double v = tform[y*pi->width+x];
+	if (v < thresh) return 0;
+	if (y > 0 && tform[(y-1)*pi->width+x] > v) return 0;
+	if (y < pi->height-1 && tform[(y+1)*pi->width+x] > v) return 0;
+	return 1;
+}
+
+// Adds a detected note to the list, growing it as needed
+static void add_detected(detected** d, int* n, int* cap, int key, long long s0,
+		long long s1, double peak)
+{
+	if (*n == *cap)
+	{
+		*cap = (*cap > 0) ? *cap*2 : 64;
+		*d = realloc(*d, *cap*sizeof(detected));
+	}
+	if (s0 < 0) s0 = 0;
+	if (s1-s0 > (long long)NOTE_TAIL) s1 = s0+NOTE_TAIL; // render_music plays at most this long
+	(*d)[*n].n.pitch = key;
+	(*d)[*n].n.start = s0;
+	(*d)[*n].n.dur = s1-s0;
+	(*d)[*n].n.volume = (peak >= 1) ? 255 : (unsigned int)(peak*255);
+	(*d)[*n].peak = peak;
+	(*n)++;
+}
+
+// Piano key of row y at column x, placing the ridge between rows by fitting a
+// parabola through the row and its neighbours. Row y is at
+// baseF*2^(y/height*W_KEYS/12) Hz, so there are W_KEYS/height keys per row.
+static int ridge_key(double* tform, process_info* pi, int y, int x)
+{
+	double c, l, r, d, pos = y;
+	if (y > 0 && y < pi->height-1)
+	{
+		l = tform[(y-1)*pi->width+x];
+		c = tform[y*pi->width+x];
+		r = tform[(y+1)*pi->width+x];
+		d = l-2*c+r;
+		if (d < 0) pos += 0.5*(l-r)/d;
+	}
+	return (int)floor(pos*W_KEYS/pi->height+0.5);
+}
+
+// Finds notes in a transform by following its ridges (rows that are local
+// maxima across frequency) along time. A note starts where a ridge appears or
+// rises again after a dip, and lasts until the ridge has been gone for more
+// than SEED_GAP columns; its key is the frequency of the ridge at its peak.
+// Sets notes to the notes found, strongest first, and returns how many there are.
+int find_notes(double* tform, process_info* pi, wav_info* header, note** notes)
+{
+	int x, y, key, x0, xp, last, ridge, n = 0, cap = 0;
+	double v, max = 0, thresh, peak, low;
+	detected* d = NULL;
+
+	for (x=0; x < pi->width*pi->height; x++)
+	{
+		if (tform[x] > max) max = tform[x];
+	}
+	thresh = max*SEED_THRESH;
+
+	for (y=0; y < pi->height; y++)
+	{
+		x0 = xp = last = -1;
+		peak = low = 0;
+		for (x=0; x <= pi->width; x++)
+		{
+			ridge = (x < pi->width) && is_ridge(tform, pi, y, x, thresh);
+			v = ridge ? tform[y*pi->width+x] : 0;
+
+			// The ridge has ended, or rises again after dipping: finish the current note
+			if (x0 >= 0 && ((!ridge && (x-last > SEED_GAP || x == pi->width)) ||
+					(ridge && v >= low*SEED_RISE && low < peak)))
+			{
+				key = ridge_key(tform, pi, y, xp);
+				if (last+1-x0 >= SEED_MIN_COLS && key >= 0 && key < PIANO_KEYS)
+				{
+					add_detected(&d, &n, &cap, key, col_sample(header, pi, x0),
+							col_sample(header, pi, last+1), peak);
+				}
+				x0 = -1;
+			}
+			if (!ridge) continue;
+
+			if (x0 < 0) // Start of a note
+			{
+				x0 = xp = x;
+				peak = low = v;
+			}
+			else if (v > peak) // Still rising
+			{
+				xp = x;
+				peak = low = v;
+			}
+			else if (v < low) // Decaying
+			{
+				low = v;
+			}
+			last = x;
+		}
+	}
+
+	qsort(d, n, sizeof(detected), cmp_detected);
+	*notes = malloc((n+1)*sizeof(note));
+	for (x=0; x<n; x++)
+	{
+		(*notes)[x] = d[x].n;
+	}
+	free(d);
+	return n;
+}
+
+// Generates a population from notes found in the input (see find_notes). The
+// first song holds the strongest est_notes of them as found. The others draw
+// each note from the strongest 2*est_notes and mutate it, except that one in
+// SEED_RANDOM notes is random so the population keeps its variety.
+void gen_pop_seeded(song* pop, int pop_size, int est_notes, int upper_lim,
+		note* seeds, int nseeds)
+{
+	int i, j, pool = (2*est_notes < nseeds) ? 2*est_notes : nseeds;
+	note* n = malloc((est_notes+1)*sizeof(note));
+
+	for (i=0; i<pop_size; i++)
+	{
+		init_song(&pop[i]);
+		for (j=0; j<est_notes; j++)
+		{
+			if (i == 0 && j < nseeds)
+			{
+				n[j] = seeds[j];
+			}
+			else if (i > 0 && pool > 0 && rng_next()%SEED_RANDOM != 0)
+			{
+				n[j] = seeds[rng_next()%pool];
+				mutate_note(&n[j], upper_lim);
+			}
+			else
+			{
+				randomize_note(&n[j], upper_lim);
+			}
+		}
+		add_notes(n, est_notes, &pop[i]);
+	}
+	free(n);
+}
@@ -0,0 +1,18 @@
+#ifndef SEED
+#define SEED
+
+#include "song.h"
+#include "wav_rw.h"
+#include "transform.h"
+
+#define SEED_THRESH 0.05	// Smallest ridge value that can be a note, relative to the maximum
+#define SEED_RISE 1.5		// Rise along a ridge after a dip that starts a new note
+#define SEED_MIN_COLS 2		// Fewest columns a ridge must last to be a note
+#define SEED_GAP 1			// Most columns a ridge can vanish for within a note
+#define SEED_RANDOM 4		// One in this many notes of seeded songs is random
+
+int find_notes(double* tform, process_info* pi, wav_info* header, note** notes);
+void gen_pop_seeded(song* pop, int pop_size, int est_notes, int upper_lim,
+		note* seeds, int nseeds);
+
+#endif
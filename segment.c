@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "segment.h"
+
+// One window of the input
+typedef struct segment
+{
+	long long a, b;			// Samples of the input covered: [a,b)
+	long long own0, own1;	// Note starts the segment is responsible for: [own0,own1)
+	int cols;				// Transform columns (the same per second as the whole input)
+	song best;				// Transcription, with starts relative to a
+	int err;				// Library error code of the transcription
+} segment;
+
+// Segments shared by the threads transcribing them
+typedef struct seg_job
+{
+	at_bank* bank;
+	at_options* opt;
+	int* signal;
+	seg_info* si;
+	segment* segs;
+	int nsegs;
+	int next;				// Next segment to transcribe
+	pthread_mutex_t lock;	// Guards next
+} seg_job;
+
+// A note of the stitched transcription and the segment it came from
+typedef struct seg_note
+{
+	note n;
+	int seg;
+} seg_note;
+
+// Orders notes by pitch, then start time
+static int cmp_seg_note(const void* p, const void* q)
+{
+	const seg_note *a = p, *b = q;
+	if (a->n.pitch != b->n.pitch) return (a->n.pitch < b->n.pitch) ? -1 : 1;
+	if (a->n.start != b->n.start) return (a->n.start < b->n.start) ? -1 : 1;
+	return 0;
+}
+
+// Thread transcribing segments until there are none left
+static void* seg_main(void* arg)
+{
+	seg_job* job = arg;
+	segment* seg;
+	at_options opt;
+	at_ctx* ctx;
+	int k;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&job->lock);
+		k = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (k >= job->nsegs) break;
+
+		seg = &job->segs[k];
+		opt = *job->opt;
+		opt.width = seg->cols;
+		opt.st = 0;
+		opt.et = ((double)(seg->b-seg->a))/FS;
+		opt.rng_seed += k;
+		ctx = at_new(job->bank, &opt, &seg->err);
+		if (ctx != NULL)
+		{
+			seg->err = at_set_input(ctx, job->signal+seg->a, seg->b-seg->a, FS);
+			if (seg->err == 0) seg->err = at_transcribe(ctx, &seg->best);
+			at_free(ctx);
+		}
+		if (seg->err < 0) init_song(&seg->best);
+		else if (job->si->verbose)
+		{
+			printf("Segment %d of %d (%.2f to %.2f s): best error %g\n", k+1,
+					job->nsegs, ((double)seg->a)/FS, ((double)seg->b)/FS, seg->best.err);
+		}
+	}
+	return NULL;
+}
+
+// Transcribes the input from opt->st to opt->et in overlapping segments of
+// si->len seconds, si->threads at a time, each with its own population and a
+// transform of as many columns per second as the whole input would have.
+// Songs are independent of each other, so each segment only keeps the notes
+// starting in its half of the overlaps, and a note held across a boundary
+// (which the next segment hears already sounding) is merged with the note of
+// the same pitch that the next segment adds for it. Sets best to the stitched
+// song, scored against the whole input. Returns 0 on success or the error code
+// of a failed segment (best is then empty or missing that segment's notes).
+int transcribe_segments(at_bank* bank, at_options* opt, int* signal, int datalen,
+		seg_info* si, song* best)
+{
+	int i, k, m, nsegs, nthreads, ret = 0;
+	long long s0, s1, len, ovl, step, t;
+	seg_job job;
+	segment* segs;
+	seg_note *all, *p;
+	pthread_t* threads;
+	note* notes;
+	at_ctx* ctx;
+
+	init_song(best);
+	s0 = (long long)(opt->st*FS);
+	s1 = (long long)(opt->et*FS);
+	if (s0 < 0) s0 = 0;
+	if (s1 > datalen) s1 = datalen;
+	len = (long long)(si->len*FS);
+	ovl = (long long)(si->overlap*FS);
+	if (s1 <= s0 || len <= 0 || ovl < 0 || ovl >= len) return AT_ERR_ARG;
+
+	// Segments start every len-ovl samples; the last one ends with the input
+	step = len-ovl;
+	nsegs = 1;
+	while (s0+nsegs*step+ovl < s1) nsegs++;
+	segs = calloc(nsegs, sizeof(segment));
+	for (k=0; k<nsegs; k++)
+	{
+		segs[k].a = s0+k*step;
+		segs[k].b = (k == nsegs-1 || segs[k].a+len > s1) ? s1 : segs[k].a+len;
+		segs[k].own0 = (k == 0) ? 0 : segs[k].a+ovl/2;
+		segs[k].own1 = (k == nsegs-1) ? LLONG_MAX : segs[k].a+step+ovl/2;
+		segs[k].cols = (int)((double)opt->width*(segs[k].b-segs[k].a)/(s1-s0)+0.5);
+		if (segs[k].cols < SEG_MIN_COLS) segs[k].cols = SEG_MIN_COLS;
+	}
+
+	job.bank = bank;
+	job.opt = opt;
+	job.signal = signal;
+	job.si = si;
+	job.segs = segs;
+	job.nsegs = nsegs;
+	job.next = 0;
+	pthread_mutex_init(&job.lock, NULL);
+	nthreads = (si->threads < 1) ? 1 : si->threads;
+	if (nthreads > nsegs) nthreads = nsegs;
+	threads = malloc(nthreads*sizeof(pthread_t));
+	for (i=0; i<nthreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, seg_main, &job) != 0) break;
+	}
+	if (i == 0) seg_main(&job); // No threads: transcribe here
+	nthreads = i;
+	for (i=0; i<nthreads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	pthread_mutex_destroy(&job.lock);
+
+	// Gather the notes each segment is responsible for, in input time
+	m = 0;
+	for (k=0; k<nsegs; k++)
+	{
+		if (segs[k].err < 0 && ret == 0) ret = segs[k].err;
+		m += segs[k].best.size;
+	}
+	all = malloc((m+1)*sizeof(seg_note));
+	m = 0;
+	for (k=0; k<nsegs; k++)
+	{
+		for (i=0; i < segs[k].best.size; i++)
+		{
+			t = segs[k].best.start[i]+segs[k].a;
+			if (t < segs[k].own0 || t >= segs[k].own1 || t > UINT_MAX) continue;
+			all[m].n = get_note(&segs[k].best, i);
+			all[m].n.start = t;
+			all[m].seg = k;
+			m++;
+		}
+		dest_song(&segs[k].best);
+	}
+
+	// Merge notes held across boundaries
+	qsort(all, m, sizeof(seg_note), cmp_seg_note);
+	notes = malloc((m+1)*sizeof(note));
+	k = 0;
+	for (i=0; i<m; i++)
+	{
+		p = (k > 0) ? &all[k-1] : NULL;
+		if (p != NULL && p->n.pitch == all[i].n.pitch && p->seg != all[i].seg &&
+				all[i].n.start < (long long)p->n.start+p->n.dur)
+		{
+			t = (long long)all[i].n.start+all[i].n.dur;
+			if (t > (long long)p->n.start+p->n.dur) p->n.dur = t-p->n.start;
+			if (all[i].n.volume > p->n.volume) p->n.volume = all[i].n.volume;
+			p->seg = all[i].seg; // The next segment's note may continue it in turn
+		}
+		else all[k++] = all[i];
+	}
+	for (i=0; i<k; i++)
+	{
+		notes[i] = all[i].n;
+	}
+	add_notes(notes, k, best);
+	best->parent1 = best->parent2 = 0;
+
+	// Segments were scored on their own windows: score the song as a whole
+	ctx = at_new(bank, opt, &i);
+	if (ctx != NULL)
+	{
+		i = at_set_input(ctx, signal, datalen, FS);
+		if (i == 0) i = at_score(ctx, best);
+		at_free(ctx);
+	}
+	if (i < 0 && ret == 0) ret = i;
+	if (si->verbose)
+	{
+		printf("Stitched %d notes from %d segments (%d merged across boundaries): "
+				"error %g.\n", k, nsegs, m-k, best->err);
+	}
+
+	free(notes);
+	free(all);
+	free(segs);
+	return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef SEGMENT
+#define SEGMENT
+
+#include "song.h"
+#include "autotranscribe.h"
+
+#define SEG_MIN_COLS 8	// Fewest transform columns a segment is given
+
+// Settings for transcribing a long input in segments
+typedef struct seg_info
+{
+	double len;		// Length of each segment in seconds
+	double overlap;	// Seconds each segment shares with the next
+	int threads;	// Segments transcribed at once
+	int verbose;	// Whether to print each segment's result
+} seg_info;
+
+int transcribe_segments(at_bank* bank, at_options* opt, int* signal, int datalen,
+		seg_info* si, song* best);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include "selection.h"
+#include "rng.h"
+
+// Individual being ranked by fitness or error
+typedef struct ranked
+{
+	double key;	// Fitness or error the individual is ranked by
+	int idx;
+	int exact;	// Whether the score is exact (only used by rank_err)
+} ranked;
+
+// Orders ranked individuals by increasing fitness
+static int cmp_ranked(const void* a, const void* b)
+{
+	double fa = ((const ranked*)a)->key, fb = ((const ranked*)b)->key;
+	if (fa < fb) return -1;
+	if (fa > fb) return 1;
+	// Tie break on index so the order does not depend on the qsort implementation
+	return ((const ranked*)a)->idx - ((const ranked*)b)->idx;
+}
+
+// Orders ranked individuals by exactness of their score (see exact_score),
+// then by increasing error
+static int cmp_err(const void* a, const void* b)
+{
+	const ranked* ra = a;
+	const ranked* rb = b;
+	if (ra->exact != rb->exact) return rb->exact-ra->exact;
+	if (ra->key < rb->key) return -1;
+	if (ra->key > rb->key) return 1;
+	return ra->idx-rb->idx;
+}
+
+// Uniform random number in [0,1)
+static double rand_unit()
+{
+	return rng_next()/(RNG_MAX+1.0);
+}
+
+// Returns the first index of the cumulative table whose value exceeds r
+// (binary search, so each roulette or rank selection costs O(log n))
+static int search_cum(double* cum, int n, double r)
+{
+	int lo = 0, hi = n-1, mid;
+	while (lo < hi)
+	{
+		mid = (lo+hi)>>1;
+		if (cum[mid] > r) hi = mid;
+		else lo = mid+1;
+	}
+	return lo;
+}
+
+// Writes the indices of the population to order sorted by increasing fitness
+void rank_pop(song* pop, int pop_size, int* order)
+{
+	int i;
+	ranked* r = malloc(pop_size*sizeof(ranked));
+
+	for (i=0; i<pop_size; i++)
+	{
+		r[i].key = pop[i].fitness;
+		r[i].idx = i;
+	}
+	qsort(r, pop_size, sizeof(ranked), cmp_ranked);
+	for (i=0; i<pop_size; i++)
+	{
+		order[i] = r[i].idx;
+	}
+	free(r);
+}
+
+// Writes the indices of the population to order from best to worst: songs
+// with exact scores first, each group by increasing error. Unlike fitness,
+// error still tells apart songs that are no better than silence.
+void rank_err(song* pop, int pop_size, int* order)
+{
+	int i;
+	ranked* r = malloc(pop_size*sizeof(ranked));
+
+	for (i=0; i<pop_size; i++)
+	{
+		r[i].key = pop[i].err;
+		r[i].idx = i;
+		r[i].exact = exact_score(&pop[i]);
+	}
+	qsort(r, pop_size, sizeof(ranked), cmp_err);
+	for (i=0; i<pop_size; i++)
+	{
+		order[i] = r[i].idx;
+	}
+	free(r);
+}
+
+// Builds the selection table for a population. Must be rebuilt whenever the
+// fitness values change (once per generation). Only rank selection sorts the
+// population, so roulette and tournament tables take O(n) to build.
+void init_selector(selector* sel, song* pop, int pop_size, int type, int tour_size)
+{
+	int i;
+	double w, sum = 0;
+
+	sel->type = type;
+	sel->size = pop_size;
+	sel->tour_size = (tour_size < 1) ? 1 : tour_size;
+	sel->pop = pop;
+	sel->cum = NULL;
+	sel->order = NULL;
+
+	if (type == SEL_TOURNAMENT) return; // Tournaments need no weight table
+
+	if (type == SEL_RANK)
+	{
+		sel->order = malloc(pop_size*sizeof(int));
+		rank_pop(pop, pop_size, sel->order);
+	}
+
+	sel->cum = malloc(pop_size*sizeof(double));
+	for (i=0; i<pop_size; i++)
+	{
+		if (type == SEL_RANK)
+		{
+			// The worst individual has weight 1, the best has weight pop_size
+			w = i+1;
+		}
+		else
+		{
+			// Negative fitness cannot be given a share of the wheel
+			w = (pop[i].fitness > 0) ? pop[i].fitness : 0;
+		}
+		sum += w;
+		sel->cum[i] = sum;
+	}
+}
+
+// Selects an individual from the population and returns its index
+int select_ind(selector* sel)
+{
+	int i, c, best;
+	double total;
+
+	if (sel->type == SEL_TOURNAMENT)
+	{
+		best = rng_next()%sel->size;
+		for (i=1; i < sel->tour_size; i++)
+		{
+			c = rng_next()%sel->size;
+			if (sel->pop[c].fitness > sel->pop[best].fitness) best = c;
+		}
+		return best;
+	}
+
+	total = sel->cum[sel->size-1];
+	// If no individual has positive fitness, every individual is equally likely
+	if (total <= 0) return rng_next()%sel->size;
+
+	i = search_cum(sel->cum, sel->size, rand_unit()*total);
+	// Rank weights are indexed by position in the sorted order
+	return (sel->type == SEL_RANK) ? sel->order[i] : i;
+}
+
+// Frees the memory used by a selection table
+void dest_selector(selector* sel)
+{
+	free(sel->cum);
+	free(sel->order);
+}
+
+// Returns whether a song's error is exact: scored in full on the full transform
+int exact_score(song* s)
+{
+	return s->done >= 1 && s->screened == 0;
+}
+
+// Converts an error value (from error_fn) to a fitness suitable for selection:
+// the improvement over silence (error init_err), which is 0 for individuals
+// that are no better than an empty song
+double err_fitness(double err, double init_err)
+{
+	return (err < init_err) ? (init_err - err) : 0;
+}
@@ -0,0 +1,29 @@
+#ifndef SELECTION
+#define SELECTION
+
+#include "song.h"
+
+#define SEL_ROULETTE 0		// Fitness proportionate selection
+#define SEL_TOURNAMENT 1	// Best of a few randomly chosen individuals
+#define SEL_RANK 2			// Linear ranking: selection weight proportional to rank
+
+// Precomputed selection table for one generation of a population
+typedef struct selector
+{
+	int type;		// Selection strategy (SEL_*)
+	int size;		// Number of individuals in the population
+	int tour_size;	// Tournament size for SEL_TOURNAMENT
+	double* cum;	// Cumulative selection weights (roulette and rank)
+	int* order;		// Population indices sorted by increasing fitness (rank only)
+	song* pop;		// Population being selected from
+} selector;
+
+void rank_pop(song* pop, int pop_size, int* order);
+void rank_err(song* pop, int pop_size, int* order);
+int exact_score(song* s);
+void init_selector(selector* sel, song* pop, int pop_size, int type, int tour_size);
+int select_ind(selector* sel);
+void dest_selector(selector* sel);
+double err_fitness(double err, double init_err);
+
+#endif
@@ -1,72 +1,240 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "song.h"
 #include "file_rw.h"
 //#include "wav_rw.h"
 
 
+// Moves the note arrays of a song into a new allocation of the given capacity
+static void resize_song(song* s, int capacity)
+{
+	unsigned int* mem = malloc(4*capacity*sizeof(unsigned int));
+	if (s->size > 0)
+	{
+		memcpy(mem, s->pitch, s->size*sizeof(unsigned int));
+		memcpy(mem+capacity, s->start, s->size*sizeof(unsigned int));
+		memcpy(mem+2*capacity, s->dur, s->size*sizeof(unsigned int));
+		memcpy(mem+3*capacity, s->volume, s->size*sizeof(unsigned int));
+	}
+	free(s->pitch); // Start of the old allocation
+	s->pitch = mem;
+	s->start = mem+capacity;
+	s->dur = mem+2*capacity;
+	s->volume = mem+3*capacity;
+	s->capacity = capacity;
+}
+
+// Moves notes idx onwards by shift places (negative: towards the start)
+static void shift_notes(song* s, int idx, int shift)
+{
+	int n = s->size-idx;
+	memmove(s->pitch+idx+shift, s->pitch+idx, n*sizeof(unsigned int));
+	memmove(s->start+idx+shift, s->start+idx, n*sizeof(unsigned int));
+	memmove(s->dur+idx+shift, s->dur+idx, n*sizeof(unsigned int));
+	memmove(s->volume+idx+shift, s->volume+idx, n*sizeof(unsigned int));
+}
+
+// Orders notes by start time
+static int cmp_start(const void* a, const void* b)
+{
+	unsigned int sa = ((const note*)a)->start, sb = ((const note*)b)->start;
+	return (sa < sb) ? -1 : (sa > sb);
+}
+
 // Sets up a new song with base capacity 10
 void init_song(song* s)
 {
-	s->capacity = 10;
 	s->size = 0;
-	s->notes = malloc(s->capacity*sizeof(note));
+	s->pitch = NULL;
+	resize_song(s, 10);
 	s->fitness = 0;
+	s->err = 0;
+	s->colerr = NULL;
+	s->done = 0;
+	s->screened = 0;
+	s->cost = 0;
+}
+
+// Returns note idx of a song
+note get_note(song* s, int idx)
+{
+	note n;
+	n.pitch = s->pitch[idx];
+	n.start = s->start[idx];
+	n.dur = s->dur[idx];
+	n.volume = s->volume[idx];
+	return n;
+}
+
+// Replaces note idx of a song. If the start time changes, sort_song must be
+// called before the song is used again.
+void set_note(song* s, int idx, note n)
+{
+	s->pitch[idx] = n.pitch;
+	s->start[idx] = n.start;
+	s->dur[idx] = n.dur;
+	s->volume[idx] = n.volume;
 }
 
-// Adds note to song and increases size of notes array if necessary
+// Adds note to song in start time order and increases size of arrays if necessary
 void add_note(note n, song* s)
 {
-	int i;
-	note* new;
-	// If new note will not fit into notes array
+	int idx;
+	// If new note will not fit into the arrays
 	if (s->size >= s->capacity)
 	{
-		s->capacity <<= 1; // Double capacity
-		new = malloc(s->capacity*sizeof(note)); // Allocate more space
-		// Move notes from old array into new
-		for (i=0; i < s->size; i++)
+		resize_song(s, s->capacity<<1); // Double capacity
+	}
+	// Insert after any notes starting at the same time
+	idx = find_start(s, (long long)n.start+1);
+	shift_notes(s, idx, 1);
+	set_note(s, idx, n);
+	s->size++;				// Increase size by 1
+}
+
+// Adds count notes to a song at once: the new notes are sorted, then merged
+// with the existing notes from the end so each note moves only once
+void add_notes(note* n, int count, song* s)
+{
+	int i, j, k;
+	note* sorted;
+
+	if (count <= 0) return;
+	if (s->size+count > s->capacity)
+	{
+		k = s->capacity;
+		while (k < s->size+count) k <<= 1;
+		resize_song(s, k);
+	}
+
+	sorted = malloc(count*sizeof(note));
+	memcpy(sorted, n, count*sizeof(note));
+	qsort(sorted, count, sizeof(note), cmp_start);
+
+	i = s->size-1;		// Last existing note not yet placed
+	j = count-1;		// Last new note not yet placed
+	k = s->size+count-1;	// Next place to fill
+	while (j >= 0)
+	{
+		if (i >= 0 && s->start[i] > sorted[j].start)
 		{
-			new[i] = s->notes[i];
+			s->pitch[k] = s->pitch[i];
+			s->start[k] = s->start[i];
+			s->dur[k] = s->dur[i];
+			s->volume[k] = s->volume[i];
+			i--;
 		}
-		free(s->notes); // Clear old array
-		s->notes = new; // Set to new array
+		else
+		{
+			set_note(s, k, sorted[j]);
+			j--;
+		}
+		k--;
 	}
-	s->notes[s->size] = n;	// Add note to array
-	s->size++;				// Increase size by 1
+	s->size += count;
+	free(sorted);
 }
 
 // Removes a note from a song
 void remove_note(song* s, int idx)
 {
-	int i;
+	remove_notes(s, idx, 1);
+}
+
+// Removes count notes starting at idx from a song
+void remove_notes(song* s, int idx, int count)
+{
+	if (idx < 0) idx = 0;
+	if (idx+count > s->size) count = s->size-idx;
+	if (count <= 0) return;
+	// Shift the following notes down, clearing the removed notes without a gap
+	shift_notes(s, idx+count, -count);
+	s->size -= count;
+}
 
-	if (idx >=0 && idx < s->size)
+// Restores start time order after notes were changed with set_note. Notes
+// usually move only a little, so an insertion sort is used.
+void sort_song(song* s)
+{
+	int i, j;
+	note n;
+	for (i=1; i < s->size; i++)
 	{
-		// Shift all notes in the array down by 1 starting just after the index to
-		// be removed, clearing the specified index without a gap
-		for (i=idx; i < (s->size-1); i++)
+		if (s->start[i-1] <= s->start[i]) continue;
+		n = get_note(s, i);
+		for (j=i; j>0 && s->start[j-1] > n.start; j--)
 		{
-			s->notes[i] = s->notes[i+1];
+			s->pitch[j] = s->pitch[j-1];
+			s->start[j] = s->start[j-1];
+			s->dur[j] = s->dur[j-1];
+			s->volume[j] = s->volume[j-1];
 		}
-		
-		s->size--; // Decrease size by 1
+		set_note(s, j, n);
 	}
 }
 
+// Returns the index of the first note starting at or after sample t
+// (binary search over the sorted start times)
+int find_start(song* s, long long t)
+{
+	int lo = 0, hi = s->size, mid;
+	while (lo < hi)
+	{
+		mid = (lo+hi)>>1;
+		if (s->start[mid] < t) lo = mid+1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// Finds the notes that may render samples in [a,b): notes first to last-1.
+// Rendering covers at most NOTE_LEAD samples before and NOTE_TAIL samples from
+// a note's start, so this is a pair of binary searches.
+void notes_in_window(song* s, long long a, long long b, int* first, int* last)
+{
+	*first = find_start(s, a-NOTE_TAIL+1);
+	*last = find_start(s, b+NOTE_LEAD);
+}
+
+// Creates dst as a copy of the notes and scores of src
+void copy_song(song* src, song* dst)
+{
+	init_song(dst);
+	if (src->size > dst->capacity) resize_song(dst, src->capacity);
+	memcpy(dst->pitch, src->pitch, src->size*sizeof(unsigned int));
+	memcpy(dst->start, src->start, src->size*sizeof(unsigned int));
+	memcpy(dst->dur, src->dur, src->size*sizeof(unsigned int));
+	memcpy(dst->volume, src->volume, src->size*sizeof(unsigned int));
+	dst->size = src->size;
+	dst->fitness = src->fitness;
+	dst->err = src->err;
+	dst->done = src->done;
+	dst->screened = src->screened;
+	dst->cost = src->cost;
+	dst->parent1 = src->parent1;
+	dst->parent2 = src->parent2;
+}
+
 // Performs necessary memory freeing to destroy a song
 void dest_song(song* s)
 {
-	free(s->notes);
+	free(s->pitch); // All note arrays share this allocation
+	free(s->colerr);
 }
 
 
-// Saves a song to a text file
-void write_song(song* s, char* filename)
+// Saves a song to a text file. Returns 0 on success, -1 if it could not be written.
+int write_song(song* s, char* filename)
 {
 	FILE* fp;
 	int i;
 	fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
 	
 	// Data for entire song: parents, fitness, number of notes
 	fprintf(fp, "Parents: %d, %d\r\nFitness: %E\r\nSize: %d\r\n", 
@@ -76,12 +244,12 @@ void write_song(song* s, char* filename)
 	for (i=0; i < s->size; i++)
 	{
 		fprintf(fp, "[pitch=%d, start=%.3f, dur = %.3f, volume=%d]\r\n",
-				s->notes[i].pitch,
-				((double)s->notes[i].start)/FS,
-				((double)s->notes[i].dur)/FS,
-				s->notes[i].volume);
+				s->pitch[i],
+				((double)s->start[i])/FS,
+				((double)s->dur[i])/FS,
+				s->volume[i]);
 	}
 	
-	fclose(fp);
+	return (fclose(fp) == 0) ? 0 : -1;
 }
 
@@ -2,6 +2,8 @@
 #define SONG
 
 #define FS 44100		// Sample rate
+#define NOTE_LEAD FS		// Samples rendered before a note's start (sound files start 1 second in)
+#define NOTE_TAIL (FS*9)	// Most samples rendered from a note's start onwards
 
 // Basic note: subunit of a song
 typedef struct note
@@ -13,21 +15,39 @@ typedef struct note
 } note;
 
 // Songs: the individuals for the genetic algorithm
+// Notes are stored as separate arrays for each field (all in one allocation
+// starting at pitch), kept sorted by start time
 typedef struct song
 {
-	note* notes;	// List of notes in song
+	unsigned int* pitch;	// Pitch of each note
+	unsigned int* start;	// Start time of each note (ascending)
+	unsigned int* dur;		// Duration of each note
+	unsigned int* volume;	// Volume of each note
 	int size;		// Number of notes in song
-	int capacity;	// Capacity of notes array: can increase if necessary
+	int capacity;	// Capacity of note arrays: can increase if necessary
 	double fitness;	// Fitness of individual
+	double err;		// Error of individual's transform (see error_fn)
+	double* colerr;	// Error of each transform column (NULL if not kept)
+	double done;	// Fraction of the transform scored (below 1: err is an estimate)
+	int screened;	// Coarse level err was estimated on (0: the full transform, see eval_pop)
+	double cost;	// Transforms computed to score the song, as a fraction of a full one
 	int parent1;	// Parent numbers of individual for later reference
 	int parent2;
 } song;
 
 void init_song(song* s);
+note get_note(song* s, int idx);
+void set_note(song* s, int idx, note n);
 void add_note(note n, song* s);
+void add_notes(note* n, int count, song* s);
 void remove_note(song* s, int idx);
+void remove_notes(song* s, int idx, int count);
+void sort_song(song* s);
+int find_start(song* s, long long t);
+void notes_in_window(song* s, long long a, long long b, int* first, int* last);
+void copy_song(song* src, song* dst);
 void dest_song(song* s);
-void write_song(song* s, char* filename);
+int write_song(song* s, char* filename);
 
 
 #endif
\ No newline at end of file
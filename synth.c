@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <math.h>
+#include "synth.h"
+#include "piano.h"
+#include "transform.h"
+#include "rng.h"
+
+// Sets up the header of a mono 16 bit input of datalen samples at FS
+void synth_header(wav_info* header, int datalen)
+{
+	header->n_channels = 1;
+	header->sample_rate = FS;
+	header->bits_per_sample = 16;
+	header->block_align = 2;
+	header->byte_rate = FS*2;
+	header->audio_format = 1;
+	header->subchunk1_size = 16;
+	header->subchunk2_size = datalen*2;
+	header->chunk_size = 36+datalen*2;
+}
+
+// Makes a bank of synthetic notes instead of loading the sound files, so
+// songs can be rendered without the ./notes folder. Like the sound files, each
+// note is 10 seconds long and starts 1 second in; it is a decaying tone with a
+// few harmonics. Free with dest_piano.
+int synth_piano(int*** notes)
+{
+	int i, j, h;
+	double f, t, env, v;
+
+	*notes = malloc(PIANO_KEYS*sizeof(int*));
+	for (i=0; i<PIANO_KEYS; i++)
+	{
+		(*notes)[i] = calloc(FS*10, sizeof(int));
+		f = baseF*pow(2.0, i/12.0);
+		for (j=NOTE_LEAD; j<FS*10; j++)
+		{
+			t = ((double)(j-NOTE_LEAD))/FS;
+			env = SYNTH_AMP*exp(-SYNTH_DECAY*t);
+			v = 0;
+			// Harmonic h has amplitude 1/h and is left out above the Nyquist frequency
+			for (h=1; h <= SYNTH_PARTIALS && h*f < FS/2; h++)
+			{
+				v += sin(2*PI*h*f*t)/h;
+			}
+			(*notes)[i][j] = (int)(env*v);
+		}
+	}
+	return 0;
+}
+
+// Makes a song of half-second major triads over datalen samples
+void synth_chords(song* s, int datalen)
+{
+	int k;
+	note n;
+
+	init_song(s);
+	n.dur = FS/2;
+	n.volume = 160;
+	for (n.start=0; n.start+n.dur < (unsigned int)datalen; n.start += FS/2)
+	{
+		k = 24+rng_next()%36;
+		n.pitch = k;
+		add_note(n, s);
+		n.pitch = k+4;
+		add_note(n, s);
+		n.pitch = k+7;
+		add_note(n, s);
+	}
+}
+
+// Makes a song of the given number of short notes at random times, keys and
+// volumes over datalen samples
+void synth_passage(song* s, int datalen, int notes)
+{
+	int i;
+	note n;
+
+	init_song(s);
+	for (i=0; i<notes; i++)
+	{
+		n.pitch = rng_next()%PIANO_KEYS;
+		n.start = rng_next()%datalen;
+		n.dur = FS/8+rng_next()%(FS/2);
+		n.volume = 64+rng_next()%192;
+		add_note(n, s);
+	}
+}
+
+// Fills signal with a sine sweep from the lowest to the highest key of the
+// piano, rising exponentially so each key gets the same time
+void synth_sweep(int* signal, int datalen)
+{
+	int i;
+	double rate = log(pow(2.0, (PIANO_KEYS-1)/12.0))/datalen, phase;
+
+	for (i=0; i<datalen; i++)
+	{
+		// Phase is the integral of the frequency baseF*e^(rate*i) over samples
+		phase = 2*PI*baseF/FS*(exp(rate*i)-1)/rate;
+		signal[i] = (int)(SYNTH_AMP*sin(phase));
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef SYNTH
+#define SYNTH
+
+#include "song.h"
+#include "wav_rw.h"
+
+#define SYNTH_PARTIALS 3	// Harmonics in each synthetic piano note
+#define SYNTH_AMP 8000		// Peak amplitude of a synthetic piano note
+#define SYNTH_DECAY 1.5		// Decay rate of a synthetic piano note (per second)
+
+void synth_header(wav_info* header, int datalen);
+int synth_piano(int*** notes);
+void synth_chords(song* s, int datalen);
+void synth_passage(song* s, int datalen, int notes);
+void synth_sweep(int* signal, int datalen);
+
+#endif
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "tiles.h"
+#include "bmp_write.h"
+#include "prof.h"
+
+// One level of the pyramid. Columns arrive one at a time and are kept in a
+// strip until there are enough for a column of tiles; every pair of columns
+// is also pooled into one column of the next level.
+typedef struct tile_level
+{
+	int width;			// Size of the level's image
+	int height;
+	double* mag;		// Strip of up to TILE_SIZE columns, column by column
+	double* phase;		// Phases of the strip (NULL: no phase colouring)
+	int n;				// Columns in the strip
+	int tx;				// Tile column the strip is written as
+	double* pend_mag;	// Column waiting for its neighbour to be pooled with
+	double* pend_phase;
+	int pending;		// Whether a column is waiting
+	double* pool_mag;	// Pooled column for the next level
+	double* pool_phase;
+} tile_level;
+
+// A pyramid being written
+typedef struct tile_info
+{
+	char* dir;			// Directory tiles are written into
+	int phase;			// Whether to colour tiles by phase
+	int nlevels;
+	tile_level* levels;	// Level 0 is the full transform; each next is half the size
+	int failed;			// Set when a tile could not be written
+} tile_info;
+
+// Writes tile row ty of the strip of level lv to dir/lv/tx_ty.bmp. Rows go
+// from the bottom of the image up, like the rows of the bitmap.
+static void write_tile(tile_info* ti, int lv, int ty)
+{
+	char filename[4096];
+	int x, y, h;
+	FILE* fp;
+	tile_level* l = &ti->levels[lv];
+	double mag[TILE_SIZE], phase[TILE_SIZE];
+	unsigned char row[3*TILE_SIZE+3] = { 0 };
+
+	h = l->height-ty*TILE_SIZE;
+	if (h > TILE_SIZE) h = TILE_SIZE;
+	snprintf(filename, sizeof(filename), "%s/%d/%d_%d.bmp", ti->dir, lv, l->tx, ty);
+	fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		if (!ti->failed) perror(filename);
+		ti->failed = 1;
+		return;
+	}
+	write_bmp_header(fp, h, l->n);
+	for (y=ty*TILE_SIZE; y < ty*TILE_SIZE+h; y++)
+	{
+		for (x=0; x < l->n; x++)
+		{
+			mag[x] = l->mag[x*l->height+y];
+			if (ti->phase) phase[x] = l->phase[x*l->height+y];
+		}
+		// The row is followed by its padding, which stays zero
+		encode_pixels(mag, phase, l->n, ti->phase, row);
+		fwrite(row, 1, 3*l->n+l->n%4, fp);
+	}
+	fclose(fp);
+}
+
+// Writes the strip of level lv as a column of tiles and empties it
+static void flush_strip(tile_info* ti, int lv)
+{
+	int ty;
+	tile_level* l = &ti->levels[lv];
+
+	if (l->n == 0) return;
+	for (ty=0; ty*TILE_SIZE < l->height; ty++)
+	{
+		write_tile(ti, lv, ty);
+	}
+	l->tx++;
+	l->n = 0;
+}
+
+// Max-pools column a (and column b, unless it is NULL) of height h, 2 rows at a
+// time, into out. The phase of a pooled point is that of its largest magnitude.
+static void pool_cols(double* amag, double* aph, double* bmag, double* bph, int h,
+		double* omag, double* oph)
+{
+	int y, y2;
+	double m;
+
+	for (y2=0; y2 < (h+1)/2; y2++)
+	{
+		m = -1;
+		for (y=2*y2; y < 2*y2+2 && y < h; y++)
+		{
+			if (amag[y] > m)
+			{
+				m = amag[y];
+				if (oph != NULL) oph[y2] = aph[y];
+			}
+			if (bmag != NULL && bmag[y] > m)
+			{
+				m = bmag[y];
+				if (oph != NULL) oph[y2] = bph[y];
+			}
+		}
+		omag[y2] = m;
+	}
+}
+
+// Adds a column to level lv, writing tiles and pooling into the next level as
+// columns accumulate
+static void push_col(tile_info* ti, int lv, double* mag, double* phase)
+{
+	tile_level* l = &ti->levels[lv];
+	int h = l->height;
+
+	memcpy(l->mag+l->n*h, mag, h*sizeof(double));
+	if (ti->phase) memcpy(l->phase+l->n*h, phase, h*sizeof(double));
+	l->n++;
+
+	if (lv+1 < ti->nlevels)
+	{
+		if (!l->pending)
+		{
+			memcpy(l->pend_mag, mag, h*sizeof(double));
+			if (ti->phase) memcpy(l->pend_phase, phase, h*sizeof(double));
+			l->pending = 1;
+		}
+		else
+		{
+			pool_cols(l->pend_mag, l->pend_phase, mag, phase, h, l->pool_mag, l->pool_phase);
+			l->pending = 0;
+			push_col(ti, lv+1, l->pool_mag, l->pool_phase);
+		}
+	}
+	if (l->n == TILE_SIZE) flush_strip(ti, lv);
+}
+
+// Makes a directory unless it exists. Returns -1 on failure.
+static int make_dir(char* path)
+{
+	if (mkdir(path, 0777) < 0 && errno != EEXIST)
+	{
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+// Writes dir/index.json, describing the levels and how tiles are named
+static int write_index(tile_info* ti, process_info* pi)
+{
+	char filename[4096];
+	int lv;
+	FILE* fp;
+	tile_level* l;
+
+	snprintf(filename, sizeof(filename), "%s/index.json", ti->dir);
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+	fprintf(fp, "{\n\"width\": %d,\n\"height\": %d,\n\"tile_size\": %d,\n", pi->width,
+			pi->height, TILE_SIZE);
+	fprintf(fp, "\"start_time\": %g,\n\"end_time\": %g,\n\"phase\": %d,\n", pi->st,
+			pi->et, ti->phase);
+	fprintf(fp, "\"tiles\": \"{level}/{x}_{y}.bmp\",\n\"origin\": \"bottom-left\",\n");
+	fprintf(fp, "\"pooling\": \"max\",\n\"levels\": [");
+	for (lv=0; lv < ti->nlevels; lv++)
+	{
+		l = &ti->levels[lv];
+		fprintf(fp, "%s\n{\"level\": %d, \"width\": %d, \"height\": %d, \"cols\": %d, "
+				"\"rows\": %d}", (lv > 0) ? "," : "", lv, l->width, l->height,
+				(l->width+TILE_SIZE-1)/TILE_SIZE, (l->height+TILE_SIZE-1)/TILE_SIZE);
+	}
+	fprintf(fp, "\n]\n}\n");
+	fclose(fp);
+	return 0;
+}
+
+// Writes a normalized transform as a zoom pyramid of TILE_SIZE square bitmap
+// tiles in dir (see write_index), coloured like writeToImage. Level 0 is the
+// transform itself and each level after it halves the width and height by
+// max-pooling, up to the first level that fits in one tile. The levels are
+// built together in one pass over the columns, each holding only one strip of
+// tiles. Returns 0 on success, -1 if a file could not be written.
+int write_tiles(char* dir, process_info* pi, double* tform, double* tphase)
+{
+	char path[4096];
+	int x, y, lv, w, h, ret = 0;
+	double *col, *colph;
+	tile_info ti;
+	tile_level* l;
+	long long start = prof_start();
+
+	ti.dir = dir;
+	ti.phase = pi->phase && tphase != NULL;
+	ti.failed = 0;
+	ti.nlevels = 1;
+	for (w=pi->width, h=pi->height; w > TILE_SIZE || h > TILE_SIZE; w=(w+1)/2, h=(h+1)/2)
+	{
+		ti.nlevels++;
+	}
+	if (make_dir(dir) < 0) return -1;
+
+	ti.levels = calloc(ti.nlevels, sizeof(tile_level));
+	w = pi->width;
+	h = pi->height;
+	for (lv=0; lv < ti.nlevels; lv++)
+	{
+		l = &ti.levels[lv];
+		l->width = w;
+		l->height = h;
+		l->mag = malloc(TILE_SIZE*h*sizeof(double));
+		l->pend_mag = malloc(h*sizeof(double));
+		l->pool_mag = malloc(((h+1)/2)*sizeof(double));
+		if (ti.phase)
+		{
+			l->phase = malloc(TILE_SIZE*h*sizeof(double));
+			l->pend_phase = malloc(h*sizeof(double));
+			l->pool_phase = malloc(((h+1)/2)*sizeof(double));
+		}
+		snprintf(path, sizeof(path), "%s/%d", dir, lv);
+		if (make_dir(path) < 0) ti.failed = 1;
+		w = (w+1)/2;
+		h = (h+1)/2;
+	}
+
+	col = malloc(pi->height*sizeof(double));
+	colph = malloc(pi->height*sizeof(double));
+	for (x=0; x < pi->width && !ti.failed; x++)
+	{
+		for (y=0; y < pi->height; y++)
+		{
+			col[y] = tform[y*pi->width+x];
+			if (ti.phase) colph[y] = tphase[y*pi->width+x];
+		}
+		push_col(&ti, 0, col, colph);
+	}
+
+	// Pool the last odd columns on their own and write the partial strips
+	for (lv=0; lv < ti.nlevels && !ti.failed; lv++)
+	{
+		l = &ti.levels[lv];
+		if (l->pending)
+		{
+			pool_cols(l->pend_mag, l->pend_phase, NULL, NULL, l->height, l->pool_mag,
+					l->pool_phase);
+			l->pending = 0;
+			push_col(&ti, lv+1, l->pool_mag, l->pool_phase);
+		}
+		flush_strip(&ti, lv);
+	}
+	if (ti.failed || write_index(&ti, pi) < 0) ret = -1;
+
+	for (lv=0; lv < ti.nlevels; lv++)
+	{
+		l = &ti.levels[lv];
+		free(l->mag);
+		free(l->phase);
+		free(l->pend_mag);
+		free(l->pend_phase);
+		free(l->pool_mag);
+		free(l->pool_phase);
+	}
+	free(ti.levels);
+	free(col);
+	free(colph);
+	prof_stop(PROF_TILES, start);
+	return ret;
+}
@@ -0,0 +1,10 @@
+#ifndef TILES
+#define TILES
+
+#include "transform.h"
+
+#define TILE_SIZE 256	// Width and height of a full tile in pixels
+
+int write_tiles(char* dir, process_info* pi, double* tform, double* tphase);
+
+#endif
@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include "transform.h"
+#include "prof.h"
+
+// Evaluate convolution of wavelet arr (of length s) with signal sig (of length datalen)
+// centered at sample i of signal
+double conv(double arr[], int s, int* sig, int datalen, int i)
+{
+	int j, elnum;
+	double sum = 0;
+	for (j=0; j<s; j++)
+	{
+		elnum = i-(s>>1)+j; // elnum is centered around 0
+		if (elnum>=0 && elnum<datalen) // Prevent exceeding bounds of sig array
+		{
+			sum += (arr[j]*sig[elnum]);
+		}
+	}
+
+	return sum;
+}
+
+// Evaluates the convolutions of both wavelets wr and wj (of length s) with
+// signal sig (of length datalen) centered at each of the n samples idx, setting
+// r and j. CONV_COLS columns are calculated per pass over the wavelet, so each
+// tap loaded is used for all of them while the sums stay in registers. Sums are
+// added in the same order as conv, so the results are identical.
+void conv_cols(double* wr, double* wj, int s, int* sig, int datalen, int* idx, int n,
+		double* r, double* j)
+{
+	int k, t;
+	double sr[CONV_COLS], sj[CONV_COLS], v;
+	int* p[CONV_COLS];
+
+	// Windows running off either end of the signal need bounds checks
+	if (n != CONV_COLS || idx[0]-(s>>1) < 0 || idx[n-1]-(s>>1)+s > datalen)
+	{
+		for (k=0; k<n; k++)
+		{
+			r[k] = conv(wr, s, sig, datalen, idx[k]);
+			j[k] = conv(wj, s, sig, datalen, idx[k]);
+		}
+		return;
+	}
+
+	for (k=0; k<CONV_COLS; k++)
+	{
+		p[k] = sig+idx[k]-(s>>1);
+		sr[k] = sj[k] = 0;
+	}
+	for (t=0; t<s; t++)
+	{
+		for (k=0; k<CONV_COLS; k++)
+		{
+			v = p[k][t];
+			sr[k] += wr[t]*v;
+			sj[k] += wj[t]*v;
+		}
+	}
+	for (k=0; k<CONV_COLS; k++)
+	{
+		r[k] = sr[k];
+		j[k] = sj[k];
+	}
+}
+
+// Corrects the start and end times of the transform if they are invalid
+void clamp_times(wav_info* header, int datalen, process_info* pi)
+{
+	double timelen = ((double)datalen)/header->sample_rate;
+	if (pi->st < 0) pi->st = 0;
+	if (pi->et > timelen)
+	{
+		pi->et = timelen;
+		//printf("Changed end time to %g seconds.\n", pi->et);
+	}
+}
+
+// Calculates the wavelets for every row of the transform. Also corrects the
+// start and end times of the transform if they are invalid. The wavelets only
+// depend on the height, beta and sample rate.
+void init_kernels(kernel_bank* kb, wav_info* header, int datalen, process_info* pi)
+{
+	int y, i, N, mid;
+	double T, b, s, A;
+	long long start = prof_start();
+	
+	clamp_times(header, datalen, pi);
+
+	kb->height = pi->height;
+	kb->N = malloc(pi->height*sizeof(int));
+	kb->sigma = malloc(pi->height*sizeof(double));
+	kb->freq = malloc(pi->height*sizeof(double));
+	kb->w_r = malloc(pi->height*sizeof(double*));
+	kb->w_j = malloc(pi->height*sizeof(double*));
+	kb->max_N = 0;
+
+	b = pi->b1;
+	for (y=0; y<pi->height; y++)
+	{
+		// Period of wavelet: set up so the highest frequency is at the top of image
+		// and the lowest frequency is at the bottom
+		T = header->sample_rate/
+				(baseF*pow(2.0,((double)y)/pi->height*W_KEYS/12));
+		// Std deviation of gaussian envelope: proportional to period
+		s = T*b;
+		kb->sigma[y] = s;
+		kb->freq[y] = 1/T;
+		// Wavelet amplitude: 1/s negates the convolution value being proportional
+		// to s
+		A = 1/s;
+		// Length in samples of wavelet
+		N = ((int)s)*8 + 1;
+		kb->N[y] = N;
+		if (N > kb->max_N) kb->max_N = N;
+		// Midpoint of wavelet in samples
+		mid = (N-1)/2;
+
+		// Calculate real and imaginary wavelet values
+		kb->w_r[y] = malloc(N*sizeof(double));
+		kb->w_j[y] = malloc(N*sizeof(double));	
+		for (i=0; i<N; i++)
+		{
+			kb->w_r[y][i] = A*exp(-((long long)(i-mid))*(i-mid)/(s*s))*cos(2*PI/T*(i-mid));
+			kb->w_j[y][i] = A*exp(-((long long)(i-mid))*(i-mid)/(s*s))*sin(2*PI/T*(i-mid));
+		}
+	}
+	prof_stop(PROF_KERNELS, start);
+}
+
+// Frees the wavelets of a kernel bank
+void dest_kernels(kernel_bank* kb)
+{
+	int y;
+	for (y=0; y < kb->height; y++)
+	{
+		free(kb->w_r[y]);
+		free(kb->w_j[y]);
+	}
+	free(kb->w_r);
+	free(kb->w_j);
+	free(kb->N);
+	free(kb->sigma);
+	free(kb->freq);
+}
+
+// Sample number of the signal that column x of the transform is centered at
+int col_sample(wav_info* header, process_info* pi, int x)
+{
+	return (x*(pi->et-pi->st)/pi->width+pi->st)*header->sample_rate;
+}
+
+// Spacing in samples of the points row y is evaluated at when undersampling.
+// A row's values change no faster than its gaussian envelope, exp(-t^2/s^2),
+// and cubic interpolation of that at a spacing of h*s is off by at most about
+// 0.1*h^3 of its peak, so the spacing is chosen to keep the error within pi->tol
+// (US_TOL if it is not set).
+int row_hop(kernel_bank* kb, process_info* pi, int y)
+{
+	double tol = (pi->tol > 0) ? pi->tol : US_TOL;
+	int h = (int)(kb->sigma[y]*cbrt(tol/0.1));
+	return (h < 1) ? 1 : h;
+}
+
+// Samples either side of a column's center that its value depends on: half the
+// longest wavelet, plus the interpolation points around it when undersampling
+// (the bottom row has the widest envelope, so the longest hop)
+int col_reach(kernel_bank* kb, process_info* pi)
+{
+	return (kb->max_N>>1)+(pi->us ? 2*row_hop(kb, pi, 0) : 0);
+}
+
+// Rounds a/b down to an integer (b > 0)
+static int floor_div(int a, int b)
+{
+	return (a >= 0) ? a/b : -((-a+b-1)/b);
+}
+
+// Evaluates row y at every hop samples from sample m0*hop to m1*hop, giving
+// values g_r and g_j demodulated by the row's frequency so they only vary as
+// fast as the wavelet's envelope. Returns the number of points evaluated.
+static int eval_grid(kernel_bank* kb, int y, int* signal, int datalen, int hop, int m0,
+		int m1, double* g_r, double* g_j)
+{
+	int m, k, n, idx[CONV_COLS];
+	double r[CONV_COLS], j[CONV_COLS], c, s, ph;
+
+	for (m=m0; m<=m1; m+=n)
+	{
+		n = (m1-m+1 < CONV_COLS) ? m1-m+1 : CONV_COLS;
+		for (k=0; k<n; k++)
+		{
+			idx[k] = (m+k)*hop;
+		}
+		conv_cols(kb->w_r[y], kb->w_j[y], kb->N[y], signal, datalen, idx, n, r, j);
+		for (k=0; k<n; k++)
+		{
+			// A tone at the row's frequency turns the value by -2*PI*freq per
+			// sample, so turn it back (keeping the angle small for precision)
+			ph = 2*PI*(kb->freq[y]*idx[k]-floor(kb->freq[y]*idx[k]));
+			c = cos(ph);
+			s = sin(ph);
+			g_r[m-m0+k] = r[k]*c-j[k]*s;
+			g_j[m-m0+k] = r[k]*s+j[k]*c;
+		}
+	}
+	return m1-m0+1;
+}
+
+// Catmull-Rom cubic through p[0] to p[3], at fraction u of the way from p[1] to p[2]
+static double cubic(double* p, double u)
+{
+	return p[1]+0.5*u*(p[2]-p[0]+u*(2*p[0]-5*p[1]+4*p[2]-p[3]+u*(3*(p[1]-p[2])+p[3]-p[0])));
+}
+
+// Calculates columns x0 to x1-1 of the wavelet transform, dividing the values by
+// pi->norm if it is set. Returns the largest magnitude before division. tphase
+// may be NULL if phase is not needed. When undersampling, rows whose hop (see
+// row_hop) is longer than the column spacing are evaluated every hop samples on
+// a grid fixed relative to the signal, and columns are interpolated from the
+// demodulated values, so a column's value does not depend on which columns are
+// calculated with it.
+double wavelet_cols(kernel_bank* kb, wav_info* header, int datalen, process_info* pi,
+		int* signal, int x0, int x1, double* tform, double* tphase)
+{
+	int x, y, k, n, N, hop, m, m0, m1, idx[CONV_COLS];
+	double r[CONV_COLS], j[CONV_COLS], mag, max=0, u, re, im, c, s, ph;
+	double scale = (pi->norm > 0) ? 1/pi->norm : 1;
+	double spacing = (pi->et-pi->st)*header->sample_rate/pi->width;
+	double *g_r = NULL, *g_j = NULL;
+	long long start = prof_start(), row, taps = 0, points = 0, interp = 0;
+
+	for (y=0; y<pi->height; y++)
+	{
+		row = prof_start();
+		N = kb->N[y];
+		hop = pi->us ? row_hop(kb, pi, y) : 0;
+
+		if (hop > spacing && x1 > x0)
+		{
+			// Grid points from one before the first column to two after the last
+			m0 = floor_div(col_sample(header, pi, x0), hop)-1;
+			m1 = floor_div(col_sample(header, pi, x1-1), hop)+2;
+			g_r = realloc(g_r, (m1-m0+1)*sizeof(double));
+			g_j = realloc(g_j, (m1-m0+1)*sizeof(double));
+			n = eval_grid(kb, y, signal, datalen, hop, m0, m1, g_r, g_j);
+			taps += 2LL*N*n;
+			points += n;
+			interp += x1-x0;
+			
+			for (x=x0; x<x1; x++)
+			{
+				k = col_sample(header, pi, x);
+				m = floor_div(k, hop);
+				u = ((double)(k-m*hop))/hop;
+				re = cubic(g_r+m-1-m0, u);
+				im = cubic(g_j+m-1-m0, u);
+				
+				mag = sqrt(re*re+im*im);
+				if (mag > max)
+				{
+					max = mag;
+				}
+				tform[y*pi->width+x] = mag*scale;
+				if (tphase != NULL)
+				{
+					// Turn the value back to the column's sample
+					ph = 2*PI*(kb->freq[y]*k-floor(kb->freq[y]*k));
+					c = cos(ph);
+					s = sin(ph);
+					tphase[y*pi->width+x] = atan2(im*c-re*s, re*c+im*s);
+				}
+			}
+			prof_stop(PROF_ROW, row);
+			continue;
+		}
+
+		for (x=x0; x<x1; x+=n)
+		{
+			// Sample numbers to evaluate convolutions at: several per pass
+			for (n=0; n<CONV_COLS && x+n<x1; n++)
+			{
+				idx[n] = col_sample(header, pi, x+n);
+			}
+			// Real and imaginary components
+			conv_cols(kb->w_r[y], kb->w_j[y], N, signal, datalen, idx, n, r, j);
+			
+			for (k=0; k<n; k++)
+			{
+				// Calculate transform magnitude
+				mag = sqrt(r[k]*r[k]+j[k]*j[k]);
+				if (mag > max)
+				{
+					max = mag;
+				}
+				tform[y*pi->width+x+k] = mag*scale;
+				// Calculate transform phase angle
+				if (tphase != NULL) tphase[y*pi->width+x+k] = atan2(j[k],r[k]);
+			}
+			taps += 2LL*N*n;
+			points += n;
+		}
+		prof_stop(PROF_ROW, row);
+	}
+	free(g_r);
+	free(g_j);
+	prof_add(PROF_TAPS, taps);
+	prof_add(PROF_POINTS, points);
+	prof_add(PROF_INTERP, interp);
+	prof_stop(PROF_TRANSFORM, start);
+	
+	return max;
+}
+
+// Performs wavelet transform and returns the largest magnitude before normalization
+double wavelet_trans(wav_info* header, int datalen, process_info* pi,
+		int* signal, double* tform, double* tphase)
+{
+	double max;
+	kernel_bank kb;
+	
+	init_kernels(&kb, header, datalen, pi);
+	max = wavelet_cols(&kb, header, datalen, pi, signal, 0, pi->width, tform, tphase);
+	dest_kernels(&kb);
+	
+	// Make maximum value of transform 1 unless a fixed divisor was given
+	if (pi->norm <= 0) normalize_transform(tform, pi->width*pi->height, max);
+	
+	return max;
+}
+
+// A channel transformed by a thread of wavelet_channels
+typedef struct channel_job
+{
+	kernel_bank* kb;
+	wav_info* header;
+	int datalen;
+	process_info* pi;
+	int* signal;
+	double* tform;
+	double* tphase;
+} channel_job;
+
+// Thread transforming one channel
+static void* channel_main(void* arg)
+{
+	channel_job* job = arg;
+	wavelet_cols(job->kb, job->header, job->datalen, job->pi, job->signal, 0,
+			job->pi->width, job->tform, job->tphase);
+	return NULL;
+}
+
+// Mixes the transforms of n channels (magnitudes tforms[k], phases tphases[k]),
+// giving the magnitude and phase of gains[k] times each channel's values summed.
+// The transform is linear, so this is the transform of the mixed signal. out_phase
+// may be NULL. Returns the largest magnitude.
+double mix_channels(process_info* pi, double** tforms, double** tphases, double* gains,
+		int n, double* out, double* out_phase)
+{
+	int i, k, size = pi->width*pi->height;
+	double re, im, mag, max = 0;
+	
+	for (i=0; i<size; i++)
+	{
+		re = im = 0;
+		for (k=0; k<n; k++)
+		{
+			re += gains[k]*tforms[k][i]*cos(tphases[k][i]);
+			im += gains[k]*tforms[k][i]*sin(tphases[k][i]);
+		}
+		mag = sqrt(re*re+im*im);
+		if (mag > max) max = mag;
+		out[i] = mag;
+		if (out_phase != NULL) out_phase[i] = atan2(im, re);
+	}
+	return max;
+}
+
+// Transforms each channel of the signal, chans[0] to chans[n_channels-1], into
+// tforms[k] and tphases[k] on its own thread, sharing one kernel bank, and mixes
+// them into tform and tphase (which may be NULL): the transform of the channels'
+// sum, which read_signal reads. All are divided by the largest magnitude of the
+// sum (or pi->norm if it is set), which is returned, so channels keep their
+// levels relative to each other.
+double wavelet_channels(wav_info* header, int datalen, process_info* pi, int** chans,
+		double** tforms, double** tphases, double* tform, double* tphase)
+{
+	int k, n = header->n_channels, size = pi->width*pi->height;
+	double max, *gains;
+	process_info raw = *pi;
+	kernel_bank kb;
+	pthread_t* threads;
+	int* started;
+	channel_job* jobs;
+	
+	threads = malloc(n*sizeof(pthread_t));
+	started = malloc(n*sizeof(int));
+	jobs = malloc(n*sizeof(channel_job));
+	gains = malloc(n*sizeof(double));
+	
+	raw.norm = 0; // Channels are divided once mixed
+	init_kernels(&kb, header, datalen, &raw);
+	for (k=0; k<n; k++)
+	{
+		jobs[k] = (channel_job){ .kb = &kb, .header = header, .datalen = datalen,
+				.pi = &raw, .signal = chans[k], .tform = tforms[k], .tphase = tphases[k] };
+		gains[k] = 1;
+	}
+	for (k=1; k<n; k++)
+	{
+		started[k] = pthread_create(&threads[k], NULL, channel_main, &jobs[k]) == 0;
+	}
+	channel_main(&jobs[0]);
+	for (k=1; k<n; k++)
+	{
+		// Transform here any channel a thread could not be started for
+		if (started[k]) pthread_join(threads[k], NULL);
+		else channel_main(&jobs[k]);
+	}
+	dest_kernels(&kb);
+	
+	max = mix_channels(pi, tforms, tphases, gains, n, tform, tphase);
+	normalize_transform(tform, size, (pi->norm > 0) ? pi->norm : max);
+	for (k=0; k<n; k++)
+	{
+		normalize_transform(tforms[k], size, (pi->norm > 0) ? pi->norm : max);
+	}
+	
+	free(threads);
+	free(started);
+	free(jobs);
+	free(gains);
+	return max;
+}
+
+// Normalizes the transform values so the maximum is 1 by dividing all by the maximum
+void normalize_transform(double* tform, int t_size, double max)
+{
+	int i;
+	long long start = prof_start();
+	if (max!=0)
+	{
+		for (i=0; i<t_size; i++)
+		{
+			tform[i] /= max;
+		}
+	}
+	prof_stop(PROF_NORMALIZE, start);
+}
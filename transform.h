@@ -0,0 +1,59 @@
+#ifndef TRANSFORM
+#define TRANSFORM
+
+#include "wav_rw.h"
+
+#define PI 3.14159265358979
+#define baseF 27.5		// Lowest frequency on piano
+#define W_KEYS 112		// Upper range of wavelet transform (pitches above A0)
+#define CONV_COLS 4		// Columns conv_cols calculates per pass over a wavelet
+#define US_TOL 0.02		// Default interpolation error of undersampled rows (see row_hop)
+
+// Information for the wavelet transform
+typedef struct process_info
+{
+	int height; // Output transform height
+	int width;	// Output transform width
+	double st;	// Start time of transform relative to start of audio sample
+	double et;	// End time of transform relative to start of audio sample
+	double b1;	// Beta value of transform
+	double b2;	// Second beta value -- currently unsupported
+	int sqrtt;	// Square root option with multiple beta values -- currently unsupported
+	int phase;	// Whether to calculate phase
+	int us;		// Whether to speed up calculation time by undersampling
+	double tol;	// Error allowed when undersampling, relative to a row's peak (0: US_TOL)
+	double norm;	// Fixed divisor for transform values (0: normalize the maximum to 1)
+} process_info;
+
+// Wavelets for every row of a transform, calculated once and reused
+typedef struct kernel_bank
+{
+	int height;		// Number of rows
+	int* N;			// Length in samples of each row's wavelet
+	double* sigma;	// Std deviation in samples of each row's gaussian envelope
+	double* freq;	// Frequency of each row's wavelet in cycles per sample
+	double** w_r;	// Real wavelet values of each row
+	double** w_j;	// Imaginary wavelet values of each row
+	int max_N;		// Length of the longest wavelet: the support of a column
+} kernel_bank;
+
+double conv(double arr[], int s, int* sig, int datalen, int i);
+void conv_cols(double* wr, double* wj, int s, int* sig, int datalen, int* idx, int n,
+		double* r, double* j);
+void clamp_times(wav_info* header, int datalen, process_info* pi);
+void init_kernels(kernel_bank* kb, wav_info* header, int datalen, process_info* pi);
+void dest_kernels(kernel_bank* kb);
+int col_sample(wav_info* header, process_info* pi, int x);
+int row_hop(kernel_bank* kb, process_info* pi, int y);
+int col_reach(kernel_bank* kb, process_info* pi);
+double wavelet_cols(kernel_bank* kb, wav_info* header, int datalen, process_info* pi,
+		int* signal, int x0, int x1, double* tform, double* tphase);
+double wavelet_trans(wav_info* header, int datalen, process_info* pi,
+		int* signal, double* tform, double* tphase);
+double mix_channels(process_info* pi, double** tforms, double** tphases, double* gains,
+		int n, double* out, double* out_phase);
+double wavelet_channels(wav_info* header, int datalen, process_info* pi, int** chans,
+		double** tforms, double** tphases, double* tform, double* tphase);
+void normalize_transform(double* tform, int t_size, double max);
+
+#endif
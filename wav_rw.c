@@ -3,6 +3,7 @@
 #include <string.h>
 #include "wav_rw.h"
 #include "file_rw.h"
+#include "prof.h"
 
 // Opens wav file for reading
 int open_wav_r(char* filename, FILE** fp)
@@ -106,7 +107,7 @@ void make_mono(wav_info* p_header)
 
 // Checks for a valid wav file header
 // wav file information from https://ccrma.stanford.edu/courses/422/projects/WaveFormat/
-int check_wav_header(FILE* m_fp, wav_info* p_header)
+static int read_wav_header(FILE* m_fp, wav_info* p_header)
 {
 	int bps;
 	char temp[9];
@@ -199,6 +200,15 @@ int check_wav_header(FILE* m_fp, wav_info* p_header)
 	return 0;
 }
 
+// Checks for a valid wav file header and reads it into p_header
+int check_wav_header(FILE* m_fp, wav_info* p_header)
+{
+	long long start = prof_start();
+	int ret = read_wav_header(m_fp, p_header);
+	prof_stop(PROF_HEADER, start);
+	return ret;
+}
+
 // Reads a single sample from a wav file
 int get_sample(FILE* fp, wav_info* header)
 {
@@ -233,25 +243,86 @@ int get_data_len(wav_info* header)
 	return header->subchunk2_size/((header->bits_per_sample>>3)*header->n_channels);
 }
 
-// Reads signal from file into array (automatically allocates memory for array from header data)
-// Note: converts signal to mono by adding samples on multiple channels
-void read_signal(FILE* fp, wav_info* header, int** p_signal)
+// Converts a sample of the given number of bytes to an integer, sign extending
+// it like get_sample
+static int decode_sample(unsigned char* p, int bytes)
 {
-	int i, k, datalen;
+	if (bytes == 1) return (signed char)p[0];
+	if (bytes == 4) return (int)(p[0]|(p[1]<<8)|(p[2]<<16)|((unsigned)p[3]<<24));
+	return (short)(p[0]|(p[1]<<8));
+}
+
+// Reads the sample data in blocks of WAV_READ_BLOCK bytes, writing each channel's
+// samples to chans[k] and their sum to signal in one pass. Either may be NULL.
+// Samples missing from a short file are read as 0.
+static void read_data(FILE* fp, wav_info* header, int** chans, int* signal)
+{
+	int i, j, k, n, got, v, sum;
+	int bytes = header->bits_per_sample>>3;
+	int frame = bytes*header->n_channels;	// Bytes per sample of every channel
+	int frames = (WAV_READ_BLOCK > frame) ? WAV_READ_BLOCK/frame : 1;
+	int datalen = get_data_len(header);
+	unsigned char *buf, *p;
 	
-	datalen = get_data_len(header);
-	(*p_signal) = malloc(datalen*sizeof(int));
+	buf = malloc(frames*frame);
+	if (buf == NULL)
+	{
+		perror("Read signal");
+		for (k=0; chans != NULL && k<header->n_channels; k++)
+		{
+			memset(chans[k], 0, datalen*sizeof(int));
+		}
+		if (signal != NULL) memset(signal, 0, datalen*sizeof(int));
+		return;
+	}
 	
 	fseek(fp, WAV_DATA_OFFSET, SEEK_SET);
-	
-	// Read each sample
-	for (i=0; i<datalen; i++)
+	for (i=0; i<datalen; i+=n)
 	{
-		(*p_signal)[i] = 0;
-		// Sum up samples of each channel
-		for (k=0; k<header->n_channels; k++)
+		n = (datalen-i < frames) ? datalen-i : frames;
+		got = fread(buf, frame, n, fp);
+		memset(buf+got*frame, 0, (n-got)*frame);
+		
+		for (j=0, p=buf; j<n; j++)
 		{
-			(*p_signal)[i] += get_sample(fp,header);
+			sum = 0;
+			for (k=0; k<header->n_channels; k++, p+=bytes)
+			{
+				v = decode_sample(p, bytes);
+				if (chans != NULL) chans[k][i+j] = v;
+				sum += v;
+			}
+			if (signal != NULL) signal[i+j] = sum;
 		}
 	}
-}
\ No newline at end of file
+	free(buf);
+}
+
+// Reads signal from file into array (automatically allocates memory for array from header data)
+// Note: converts signal to mono by adding samples on multiple channels
+void read_signal(FILE* fp, wav_info* header, int** p_signal)
+{
+	long long start = prof_start();
+	
+	(*p_signal) = malloc(get_data_len(header)*sizeof(int));
+	read_data(fp, header, NULL, *p_signal);
+	prof_stop(PROF_READ, start);
+}
+
+// Reads each channel of the signal into its own array, chans[0] to
+// chans[n_channels-1], in the same pass as read_signal would read their sum into
+// *p_signal (if p_signal is not NULL). Allocates the arrays from the header data.
+void read_channels(FILE* fp, wav_info* header, int** chans, int** p_signal)
+{
+	int k, datalen;
+	long long start = prof_start();
+	
+	datalen = get_data_len(header);
+	for (k=0; k<header->n_channels; k++)
+	{
+		chans[k] = malloc(datalen*sizeof(int));
+	}
+	if (p_signal != NULL) (*p_signal) = malloc(datalen*sizeof(int));
+	read_data(fp, header, chans, (p_signal != NULL) ? *p_signal : NULL);
+	prof_stop(PROF_READ, start);
+}
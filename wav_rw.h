@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 #define WAV_DATA_OFFSET 44
+#define WAV_READ_BLOCK 65536	// Bytes of sample data read_signal reads at a time
 
 typedef struct wav_info
 {
@@ -27,5 +28,6 @@ int check_wav_header(FILE* m_fp, wav_info* p_header);
 int get_sample(FILE* fp, wav_info* header);
 int get_data_len(wav_info* header);
 void read_signal(FILE* fp, wav_info* header, int** signal);
+void read_channels(FILE* fp, wav_info* header, int** chans, int** signal);
 
 #endif